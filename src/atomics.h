@@ -18,29 +18,87 @@
 #include <sched.h>
 #include <sys/wait.h>
 
-ATOMIC_INLINE int64_t rdtsc()
+/* plain loads and stores of shared memory which other processes write
+ * concurrently must go through these, so that each says what it orders:
+ *
+ *   relaxed: atomic, but orders nothing else.
+ *   acquire: later loads and stores may not move above the load.
+ *   release: earlier loads and stores may not move below the store.
+ *
+ * on x86 every one of these is an ordinary mov; only atomicBarrier() costs
+ * a fence.  the read-modify-writes below are both acquire and release. */
+
+ATOMIC_INLINE int64_t atomicLoadRelaxed64( const int64_t* v )
+{
+    return __atomic_load_n( v, __ATOMIC_RELAXED );
+}
+
+ATOMIC_INLINE int64_t atomicLoadAcquire64( const int64_t* v )
 {
-    int64_t ret;
-    __asm__ volatile( "rdtsc"
-            : "=A"( ret )
-            :
-            : );
-    return ret;
+    return __atomic_load_n( v, __ATOMIC_ACQUIRE );
 }
 
-ATOMIC_INLINE int64_t rdtscp()
+ATOMIC_INLINE void atomicStoreRelaxed64( int64_t* v, int64_t value )
 {
-    int64_t ret;
-    __asm__ volatile( "rdtscp"
-            : "=A"( ret )
-            :
-            : "ecx" );
-    return ret;
+    __atomic_store_n( v, value, __ATOMIC_RELAXED );
 }
 
-ATOMIC_INLINE int64_t xadd64( volatile int64_t* v, int64_t delta )
+ATOMIC_INLINE void atomicStoreRelease64( int64_t* v, int64_t value )
 {
-    return __sync_add_and_fetch( v, delta );
+    __atomic_store_n( v, value, __ATOMIC_RELEASE );
+}
+
+ATOMIC_INLINE int32_t atomicLoadRelaxed32( const int32_t* v )
+{
+    return __atomic_load_n( v, __ATOMIC_RELAXED );
+}
+
+/* returns the new value. */
+ATOMIC_INLINE int64_t xadd64( int64_t* v, int64_t delta )
+{
+    return __atomic_add_fetch( v, delta, __ATOMIC_ACQ_REL );
+}
+
+ATOMIC_INLINE int32_t xadd32( int32_t* v, int32_t delta )
+{
+    return __atomic_add_fetch( v, delta, __ATOMIC_ACQ_REL );
+}
+
+/* returns the previous value; the swap happened if that's 'expected'. */
+ATOMIC_INLINE int64_t cas64( int64_t* v, int64_t expected, int64_t desired )
+{
+    __atomic_compare_exchange_n( v, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE );
+    return expected;
+}
+
+/* a full fence; needed only where a store must be visible before a later
+ * load of some other location, as when deciding whether to sleep. */
+ATOMIC_INLINE void atomicBarrier()
+{
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+}
+
+/* makes earlier relaxed loads act as acquires. */
+ATOMIC_INLINE void atomicAcquire()
+{
+    __atomic_thread_fence( __ATOMIC_ACQUIRE );
+}
+
+/* makes later relaxed stores act as releases. */
+ATOMIC_INLINE void atomicRelease()
+{
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+}
+
+ATOMIC_INLINE void atomicPause()
+{
+#if defined( __i386__ ) || defined( __x86_64__ )
+    __asm__ volatile( "pause" ::: "memory" );
+#elif defined( __aarch64__ )
+    __asm__ volatile( "yield" ::: "memory" );
+#else
+    __asm__ volatile( "" ::: "memory" );
+#endif
 }
 
 ATOMIC_INLINE void atomicYield()
@@ -0,0 +1,151 @@
+#define _POSIX_C_SOURCE 200809L
+#include "clock.h"
+
+#include "atomics.h"
+#include <time.h>
+#include <unistd.h>
+
+/* each end of the calibration keeps the best of this many readings. */
+#define CALIBRATION_SAMPLES     16
+
+/* calibration states. */
+#define CALIBRATION_NONE        0
+#define CALIBRATION_READY       1
+
+/* forward declarations. */
+static int64_t getWallNs();
+static int64_t getMonotonicNs();
+static void sample( int64_t (*getNs)(), int64_t* ticks, int64_t* ns );
+static void calibrate( clockCalibration* c );
+
+/*-----------------------------------------------------------------------------
+* Public API definitions.
+*----------------------------------------------------------------------------*/
+
+bool clockIsInvariant()
+{
+#if defined( __i386__ ) || defined( __x86_64__ )
+    uint32_t eax, ebx, ecx, edx;
+
+    /* the advanced power management leaf; bit 8 is the invariant tsc. */
+    __asm__ volatile( "cpuid"
+            : "=a"( eax ), "=b"( ebx ), "=c"( ecx ), "=d"( edx )
+            : "a"( 0x80000000 ) );
+    if ( eax < 0x80000007 )
+        return false;
+
+    __asm__ volatile( "cpuid"
+            : "=a"( eax ), "=b"( ebx ), "=c"( ecx ), "=d"( edx )
+            : "a"( 0x80000007 ) );
+    return ( ( edx & ( 1 << 8 ) ) != 0 );
+#else
+    /* the generic timer, and our fallback, both run at a fixed rate. */
+    return true;
+#endif
+}
+
+void clockShare( clockCalibration* c )
+{
+    int64_t self = (int64_t)getpid();
+    int64_t calibrator;
+
+    /* the first process to get here calibrates for everyone.  if it dies
+     * partway through, the first to notice starts over. */
+    calibrator = cas64( &c->calibrator, 0, self );
+    while ( atomicLoadAcquire64( &c->state ) != CALIBRATION_READY )
+    {
+        if ( calibrator == 0 || ( !isProcessAlive( calibrator )
+                    && cas64( &c->calibrator, calibrator, self ) == calibrator ) )
+        {
+            calibrate( c );
+            atomicStoreRelease64( &c->state, CALIBRATION_READY );
+            return;
+        }
+
+        atomicYield();
+        calibrator = atomicLoadRelaxed64( &c->calibrator );
+    }
+}
+
+int64_t clockToNs( const clockCalibration* c, int64_t ticks )
+{
+    int64_t delta = ( ticks - c->ticksBase );
+    int64_t sign = 1;
+    uint64_t hi, lo;
+
+    if ( delta < 0 )
+    {
+        delta = -delta;
+        sign = -1;
+    }
+
+    /* multiply in two halves so that nothing overflows. */
+    hi = ( (uint64_t)delta >> 32 );
+    lo = ( (uint64_t)delta & 0xffffffff );
+    return c->nsBase + sign * (int64_t)( hi * c->nsPerTick + ( ( lo * c->nsPerTick ) >> 32 ) );
+}
+
+#if !defined( __i386__ ) && !defined( __x86_64__ ) && !defined( __aarch64__ )
+int64_t clockTicks()
+{
+    return getMonotonicNs();
+}
+#endif
+
+/*-----------------------------------------------------------------------------
+* File-local function definitions.
+*----------------------------------------------------------------------------*/
+
+static int64_t getWallNs()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_REALTIME, &ts );
+    return ( (int64_t)ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec );
+}
+
+static int64_t getMonotonicNs()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ( (int64_t)ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec );
+}
+
+static void sample( int64_t (*getNs)(), int64_t* ticks, int64_t* ns )
+{
+    int64_t best = -1;
+    int i;
+
+    /* read the clock between two tick counts, and keep the reading which
+     * was bracketed most tightly; the others were probably interrupted. */
+    for ( i = 0; i < CALIBRATION_SAMPLES; ++i )
+    {
+        int64_t before = clockTicksSerialized();
+        int64_t now = getNs();
+        int64_t after = clockTicksSerialized();
+
+        if ( best < 0 || after - before < best )
+        {
+            best = ( after - before );
+            *ticks = before + ( after - before ) / 2;
+            *ns = now;
+        }
+    }
+}
+
+static void calibrate( clockCalibration* c )
+{
+    int64_t startTicks, startNs;
+    int64_t endTicks, endNs;
+
+    /* count ticks against the monotonic clock, which nobody can step. */
+    sample( getMonotonicNs, &startTicks, &startNs );
+    do
+    {
+        sample( getMonotonicNs, &endTicks, &endNs );
+    } while ( endNs - startNs < CLOCK_CALIBRATION_MS * 1000 * 1000 );
+
+    c->nsPerTick = (int64_t)( ( (double)( endNs - startNs ) / ( endTicks - startTicks ) ) * 4294967296.0 );
+
+    /* then pin a tick count to the wall clock. */
+    sample( getWallNs, &c->ticksBase, &c->nsBase );
+}
@@ -0,0 +1,121 @@
+#ifndef __DISRUPTOR_CLOCK_H__
+#define __DISRUPTOR_CLOCK_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "util.h"
+
+/*-----------------------------------------------------------------------------
+* Declarations
+*----------------------------------------------------------------------------*/
+
+#define CLOCK_INLINE static inline
+
+/* relates the tick counter to wall clock nanoseconds.  it lives in shared
+ * memory, so that every process converts ticks the same way. */
+typedef struct clockCalibration
+{
+    /* zero until calibrated. */
+    int64_t state;
+
+    /* the process doing the calibrating, once one has started. */
+    int64_t calibrator;
+
+    /* a tick count and the wall clock time at which it was read. */
+    int64_t ticksBase;
+    int64_t nsBase;
+
+    /* nanoseconds per tick, in 32.32 fixed point. */
+    int64_t nsPerTick;
+} clockCalibration;
+
+/*-----------------------------------------------------------------------------
+* Function prototypes
+*----------------------------------------------------------------------------*/
+
+/* whether the tick counter runs at a constant rate regardless of power
+ * states, so that ticks can be converted to time at all. */
+bool clockIsInvariant();
+
+/* calibrate 'c' unless another process already has, in which case wait for
+ * it to finish, or take over if it dies first.  calibrating takes about
+ * CLOCK_CALIBRATION_MS. */
+#define CLOCK_CALIBRATION_MS    10
+void clockShare( clockCalibration* c );
+
+/* convert a tick count into nanoseconds since the epoch. */
+int64_t clockToNs( const clockCalibration* c, int64_t ticks );
+
+/*-----------------------------------------------------------------------------
+* Tick counters
+*
+* clockTicks() is the cheapest, but the cpu may execute it early or late
+* relative to the surrounding code.  clockTicksOrdered() waits for earlier
+* instructions to finish first, and clockTicksSerialized() also keeps later
+* ones from starting early.
+*----------------------------------------------------------------------------*/
+
+#if defined( __i386__ ) || defined( __x86_64__ )
+
+CLOCK_INLINE int64_t clockTicks()
+{
+    uint32_t lo, hi;
+    __asm__ volatile( "rdtsc"
+            : "=a"( lo ), "=d"( hi ) );
+    return ( ( (int64_t)hi << 32 ) | lo );
+}
+
+CLOCK_INLINE int64_t clockTicksOrdered()
+{
+    uint32_t lo, hi;
+    __asm__ volatile( "lfence\n\trdtsc"
+            : "=a"( lo ), "=d"( hi )
+            :
+            : "memory" );
+    return ( ( (int64_t)hi << 32 ) | lo );
+}
+
+CLOCK_INLINE int64_t clockTicksSerialized()
+{
+    uint32_t lo, hi;
+    __asm__ volatile( "rdtscp\n\tlfence"
+            : "=a"( lo ), "=d"( hi )
+            :
+            : "ecx", "memory" );
+    return ( ( (int64_t)hi << 32 ) | lo );
+}
+
+#elif defined( __aarch64__ )
+
+CLOCK_INLINE int64_t clockTicks()
+{
+    int64_t ticks;
+    __asm__ volatile( "mrs %0, cntvct_el0" : "=r"( ticks ) );
+    return ticks;
+}
+
+CLOCK_INLINE int64_t clockTicksOrdered()
+{
+    int64_t ticks;
+    __asm__ volatile( "isb\n\tmrs %0, cntvct_el0" : "=r"( ticks ) :: "memory" );
+    return ticks;
+}
+
+CLOCK_INLINE int64_t clockTicksSerialized()
+{
+    int64_t ticks;
+    __asm__ volatile( "isb\n\tmrs %0, cntvct_el0\n\tisb" : "=r"( ticks ) :: "memory" );
+    return ticks;
+}
+
+#else
+
+/* no cheap counter; count nanoseconds instead. */
+int64_t clockTicks();
+# define clockTicksOrdered      clockTicks
+# define clockTicksSerialized   clockTicks
+
+#endif
+
+#endif
+
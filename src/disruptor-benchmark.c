@@ -1,68 +1,1116 @@
+#define _GNU_SOURCE
 #include "disruptor.h"
 #include "util.h"
+#include "shmem.h"
+#include "shmap.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
+#include <sched.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#if __linux__
+# include <linux/perf_event.h>
+#endif
 
-int main(int argc, char** argv)
+/*-----------------------------------------------------------------------------
+* usage: disruptor-benchmark [-p producers] [-c consumers] [-n messages]
+*                            [-s sizes] [-r slots] [-w waits] [-b batch]
+*                            [-i] [-1] [-u] [-e] [-j] [-l label]
+*                            [-H] [-P] [-N node]
+*        disruptor-benchmark inline [messages] [size]
+*        disruptor-benchmark shmap [items]
+*        disruptor-benchmark spsc [messages]
+*
+* The first form starts the given numbers of producer and consumer
+* processes, each pinned to its own cpu unless -u is given, and has every
+* producer send its messages as fast as it can.  Every consumer receives
+* every message, and records the time from its send timestamp to its
+* receipt in a log-linear histogram.  It reports the messages and bytes per
+* second, and the latency percentiles across all consumers.  -s, -r and -w
+* take comma separated lists, and every combination is run in turn.  -i
+* inlines payloads, -1 creates the ring for a single producer, -e has the
+* consumers receive through disruptorProcess() rather than one message at a
+* time, and -j also
+* writes each result to stdout as one line of JSON, tagged with -l's label,
+* so that results can be compared across versions.  -H backs the ring with
+* huge pages, -P prefaults and locks every mapping, and -N places the ring
+* and send buffers on the given NUMA node.
+*
+* The second form sends messages of the given size from one process to
+* another, once through the send buffer and once inlined into the ring,
+* and reports the receiver's cache misses per message for each.
+*
+* The third form compares shmap's insert and lookup throughput with an
+* ordinary process-local chained hash table, then has two processes insert
+* the same keys into one shared map at once.
+*
+* The fourth form times each send and each send-plus-receive on a ring
+* with one writer and one reader, first created for multiple producers and
+* then for a single producer, and reports the percentiles of each, along
+* with the one-way latency the reader derives from the message timestamps.
+*----------------------------------------------------------------------------*/
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ( ts.tv_sec + ts.tv_nsec * 1e-9 );
+}
+
+/* returns a perf counter for this process's cache misses, or -1. */
+static int openCacheMisses()
 {
-    (void)argc;
-    (void)argv;
+#if __linux__
+    struct perf_event_attr attr;
+
+    memset( &attr, 0, sizeof( attr ) );
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof( attr );
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall( SYS_perf_event_open, &attr, 0, -1, -1, 0 );
+#else
+    return -1;
+#endif
+}
+
+static int runInlineReceiver( int64_t messages, int readyFd )
+{
+    disruptor* d;
+    disruptorMsg m;
+    int64_t received = 0;
+    int64_t misses = -1;
+    unsigned int checksum = 0;
+    double started;
+    int counter;
+
+    d = disruptorCreate( "benchmark", "receiver", 16*1024, NULL );
+    if ( !d )
+        return 1;
 
-    if ( 0 )
+    counter = openCacheMisses();
+    disruptorRecv( d );
+
+    /* tell the sender we're attached. */
+    if ( write( readyFd, "", 1 ) != 1 )
+        return 1;
+    close( readyFd );
+
+#if __linux__
+    if ( counter >= 0 )
     {
-        char* test = strformat( "Hello, %s", argv[0] );
-        printf( "%s\n", test );
-        strfree( test );
+        ioctl( counter, PERF_EVENT_IOC_RESET, 0 );
+        ioctl( counter, PERF_EVENT_IOC_ENABLE, 0 );
     }
+#endif
 
-    if ( 1 )
+    started = now();
+    while ( received < messages )
     {
-        disruptorKill( "benchmark" );
+        const char* data;
+        size_t i;
+
+        m = disruptorRecvWait( d, -1 );
+        if ( !m )
+            continue;
+
+        /* touch the whole payload, as a real reader would. */
+        data = msgGetData( d, m );
+        for ( i = 0; i < msgGetSize( d, m ); ++i )
+            checksum += (unsigned char)data[ i ];
+
+        received += 1;
     }
 
+#if __linux__
+    if ( counter >= 0 )
     {
-        int fd;
-        bool child;
+        ioctl( counter, PERF_EVENT_IOC_DISABLE, 0 );
+        if ( read( counter, &misses, sizeof( misses ) ) != sizeof( misses ) )
+            misses = -1;
+        close( counter );
+    }
+#endif
 
-        if ( 1 )
-            fd = fork();
+    {
+        double elapsed = ( now() - started );
+        if ( misses >= 0 )
+            fprintf( stderr, "  %.0f msgs/sec, %.2f cache misses/msg (checksum %u)\n",
+                    received / elapsed, (double)misses / received, checksum );
         else
-            fd = 0;
-        child = (fd == 0);
+            fprintf( stderr, "  %.0f msgs/sec, cache misses unavailable (checksum %u)\n",
+                    received / elapsed, checksum );
+    }
+
+    disruptorRelease( d );
+    return 0;
+}
+
+static int runInline( int64_t messages, size_t size )
+{
+    int pass;
+
+    for ( pass = 0; pass < 2; ++pass )
+    {
+        disruptorOptions options;
+        disruptor* d;
+        char* msg;
+        int readyFds[2];
+        int64_t i;
+        pid_t pid;
+        int status;
+        char c;
+
+        fprintf( stderr, "%lld messages of %d bytes, %s:\n", (long long)messages, (int)size,
+                ( pass ? "inline" : "send buffer" ) );
+
+        disruptorKill( "benchmark" );
+
+        memset( &options, 0, sizeof( options ) );
+        options.inlinePayloads = ( pass != 0 );
+        options.writeOnly = true;
+        d = disruptorCreate( "benchmark", "sender", 16*1024, &options );
+        if ( !d )
+            return 1;
+
+        /* the receiver joins after us, so that it can map our send buffer. */
+        if ( pipe( readyFds ) != 0 )
+            return 1;
+        pid = fork();
+        if ( pid == 0 )
+        {
+            close( readyFds[0] );
+            exit( runInlineReceiver( messages, readyFds[1] ) );
+        }
+        close( readyFds[1] );
+        if ( read( readyFds[0], &c, 1 ) != 1 )
+            return 1;
+        close( readyFds[0] );
+
+        msg = calloc( 1, size + 1 );
+        for ( i = 0; i < messages; ++i )
+        {
+            memcpy( msg, &i, ( size < sizeof( i ) ? size : sizeof( i ) ) );
+            if ( !disruptorSend( d, msg, size ) )
+                return 1;
+        }
+        free( msg );
+
+        if ( waitpid( pid, &status, 0 ) < 0 || !WIFEXITED( status ) || WEXITSTATUS( status ) != 0 )
+            return 1;
+
+        disruptorRelease( d );
+    }
+
+    disruptorKill( "benchmark" );
+    return 0;
+}
+
+/* a plain chained hash table, to compare shmap against. */
+typedef struct localEntry
+{
+    const char* key;
+    int64_t value;
+    struct localEntry* next;
+} localEntry;
+
+typedef struct localMap
+{
+    localEntry** buckets;
+    int64_t mask;
+} localMap;
+
+static uint64_t hashString( const char* key )
+{
+    uint64_t hash = 14695981039346656037ULL;
+    while ( *key )
+    {
+        hash ^= (unsigned char)*key++;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static localEntry* localFind( localMap* m, const char* key )
+{
+    localEntry* e = m->buckets[ hashString( key ) & m->mask ];
+    while ( e && strcmp( e->key, key ) != 0 )
+        e = e->next;
+    return e;
+}
+
+static localEntry* localInsert( localMap* m, const char* key )
+{
+    localEntry** bucket = &m->buckets[ hashString( key ) & m->mask ];
+    localEntry* e = *bucket;
+
+    while ( e && strcmp( e->key, key ) != 0 )
+        e = e->next;
+    if ( !e )
+    {
+        e = malloc( sizeof( localEntry ) );
+        e->key = key;
+        e->value = 0;
+        e->next = *bucket;
+        *bucket = e;
+    }
+    return e;
+}
+
+static char** makeKeys( int64_t items )
+{
+    char** keys = malloc( items * sizeof( char* ) );
+    int64_t i;
+
+    for ( i = 0; i < items; ++i )
+        keys[ i ] = strformat( "symbol:%lld", (long long)i );
+    return keys;
+}
+
+static void reportRate( const char* what, int64_t items, double elapsed )
+{
+    fprintf( stderr, "  %-24s %8.1f ns/op  %12.0f ops/sec\n",
+            what, elapsed * 1e9 / items, items / elapsed );
+}
+
+static int runShmap( int64_t items )
+{
+    char** keys = makeKeys( items );
+    int64_t size = shmapGetMemSize( sizeof( int64_t ), items );
+    int64_t checksum = 0;
+    double started;
+    int64_t i;
+
+    fprintf( stderr, "%lld items:\n", (long long)items );
+
+    /* a table which only this process can see. */
+    {
+        localMap m;
+        localEntry* e;
+
+        m.mask = 1;
+        while ( m.mask < 2 * items )
+            m.mask <<= 1;
+        m.buckets = calloc( m.mask, sizeof( localEntry* ) );
+        m.mask -= 1;
+
+        started = now();
+        for ( i = 0; i < items; ++i )
+            localInsert( &m, keys[ i ] )->value = i;
+        reportRate( "local insert", items, now() - started );
+
+        started = now();
+        for ( i = 0; i < items; ++i )
+        {
+            e = localFind( &m, keys[ i ] );
+            if ( !e )
+                return 1;
+            checksum += e->value;
+        }
+        reportRate( "local lookup", items, now() - started );
 
-        if ( 1 )
+        for ( i = 0; i <= m.mask; ++i )
         {
+            while ( ( e = m.buckets[ i ] ) )
+            {
+                m.buckets[ i ] = e->next;
+                free( e );
+            }
+        }
+        free( m.buckets );
+    }
+
+    /* shmap, in a segment any process could map. */
+    {
+        shmem* mem;
+        shmap* map;
+
+        shmemUnlink( "benchmark:shmap" );
+        mem = shmemOpen( size, SHMEM_MUST_CREATE, "benchmark:shmap" );
+        if ( !mem )
+            return 1;
+        map = shmapCreate( shmemGetPtr( mem ), size, sizeof( int64_t ), "benchmark" );
+        if ( !map )
+            return 1;
+
+        started = now();
+        for ( i = 0; i < items; ++i )
+        {
+            SharedHandle h = shmapGetItem( map, keys[ i ] );
+            if ( !h )
+                return 1;
+            *(int64_t*)shmapGetValue( map, h ) = i;
+        }
+        reportRate( "shmap insert", items, now() - started );
+
+        started = now();
+        for ( i = 0; i < items; ++i )
+        {
+            SharedHandle h = shmapFindItem( map, keys[ i ] );
+            if ( !h )
+                return 1;
+            checksum -= *(int64_t*)shmapGetValue( map, h );
+        }
+        reportRate( "shmap lookup", items, now() - started );
+
+        shmapRelease( map );
+        shmemClose( mem );
+        shmemUnlink( "benchmark:shmap" );
+    }
+
+    /* two processes racing to insert the same keys must agree on them. */
+    {
+        shmem* mem;
+        shmap* map;
+        pid_t pid;
+        int status;
+
+        mem = shmemOpen( size, SHMEM_MUST_CREATE, "benchmark:shmap" );
+        if ( !mem )
+            return 1;
+
+        started = now();
+        pid = fork();
+        map = shmapCreate( shmemGetPtr( mem ), size, sizeof( int64_t ), "benchmark" );
+        if ( !map )
+            return 1;
+        for ( i = 0; i < items; ++i )
+        {
+            if ( !shmapGetItem( map, keys[ i ] ) )
+                return 1;
+        }
+        if ( pid == 0 )
+            exit( 0 );
+        if ( waitpid( pid, &status, 0 ) < 0 || !WIFEXITED( status ) || WEXITSTATUS( status ) != 0 )
+            return 1;
+        reportRate( "shmap shared insert", 2 * items, now() - started );
+
+        if ( shmapGetCount( map ) != items )
+        {
+            fprintf( stderr, "shmap holds %lld items, expected %lld\n",
+                    (long long)shmapGetCount( map ), (long long)items );
+            return 1;
+        }
+
+        shmapRelease( map );
+        shmemClose( mem );
+        shmemUnlink( "benchmark:shmap" );
+    }
+
+    for ( i = 0; i < items; ++i )
+        strfree( keys[ i ] );
+    free( keys );
+    return ( checksum != 0 );
+}
+
+static int compareInt64( const void* a, const void* b )
+{
+    int64_t x = *(const int64_t*)a;
+    int64_t y = *(const int64_t*)b;
+    return ( x < y ? -1 : x > y );
+}
+
+static void reportPercentiles( const char* what, int64_t* samples, int64_t count )
+{
+    qsort( samples, count, sizeof( int64_t ), compareInt64 );
+    fprintf( stderr, "  %-24s p50 %6lld ns  p99 %6lld ns  p99.9 %6lld ns\n", what,
+            (long long)samples[ count / 2 ],
+            (long long)samples[ count * 99 / 100 ],
+            (long long)samples[ count * 999 / 1000 ] );
+}
+
+static int64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ( (int64_t)ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec );
+}
+
+static int runSpsc( int64_t messages )
+{
+    int64_t* sends = malloc( messages * sizeof( int64_t ) );
+    int64_t* trips = malloc( messages * sizeof( int64_t ) );
+    int64_t* ways = malloc( messages * sizeof( int64_t ) );
+    int pass;
+
+    for ( pass = 0; pass < 2; ++pass )
+    {
+        disruptorOptions options;
+        disruptor* writer;
+        disruptor* reader;
+        int64_t i;
+
+        fprintf( stderr, "%lld messages, %s:\n", (long long)messages,
+                ( pass ? "single producer" : "multiple producers" ) );
+
+        disruptorKill( "benchmark" );
+
+        memset( &options, 0, sizeof( options ) );
+        options.inlinePayloads = true;
+        options.singleProducer = ( pass != 0 );
+        options.writeOnly = true;
+        writer = disruptorCreate( "benchmark", "writer", 16*1024, &options );
+        options.writeOnly = false;
+        reader = disruptorCreate( "benchmark", "reader", 16*1024, &options );
+        if ( !writer || !reader )
+            return 1;
+        disruptorRecv( reader );
+
+        /* both ends live in this process, so that scheduling doesn't
+         * swamp what's being measured. */
+        for ( i = 0; i < messages; ++i )
+        {
+            int64_t started = nowNs();
+            int64_t sent;
             disruptorMsg m;
-            disruptor* d = disruptorCreate( "benchmark", (child ? "clientB" : "clientA"), 16*1024 );
 
-            disruptorPrintf( d, "hello, world!" );
-            disruptorPrintf( d, "hello again, world!" );
+            if ( !disruptorSend( writer, (const char*)&i, sizeof( i ) ) )
+                return 1;
+            sent = nowNs();
+            m = disruptorRecv( reader );
+            if ( !m )
+                return 1;
+
+            sends[ i ] = ( sent - started );
+            trips[ i ] = ( nowNs() - started );
+            ways[ i ] = ( disruptorGetTimeNs( reader ) - msgGetTimestampNs( reader, m ) );
+        }
+
+        reportPercentiles( "send", sends, messages );
+        reportPercentiles( "send and receive", trips, messages );
+        reportPercentiles( "one way, by timestamp", ways, messages );
+
+        disruptorRelease( reader );
+        disruptorRelease( writer );
+    }
+
+    disruptorKill( "benchmark" );
+    free( sends );
+    free( trips );
+    free( ways );
+    return 0;
+}
+
+/*-----------------------------------------------------------------------------
+* Ring benchmark
+*----------------------------------------------------------------------------*/
+
+#define RING_ADDRESS            "benchmark"
+#define RING_BUFFER_SIZE        ( 4 * 1024 * 1024 )
+#define MAX_CHILDREN            64
+#define MAX_BATCH               1024
+#define MAX_VALUES              16
 
-            while ( (m = disruptorRecv( d )) )
+/* latencies below 2*HIST_SUB nanoseconds are counted exactly.  above that,
+ * each power of two is split into HIST_SUB buckets, so that every latency
+ * is recorded to within one part in HIST_SUB. */
+#define HIST_SUB_BITS           6
+#define HIST_SUB                ( 1 << HIST_SUB_BITS )
+#define HIST_COUNTS             ( 2 * HIST_SUB + ( 62 - HIST_SUB_BITS ) * HIST_SUB )
+
+typedef struct ringConfig
+{
+    int producers;
+    int consumers;
+    int64_t messages;
+    size_t size;
+    int64_t slots;
+    const char* wait;
+    int batch;
+    bool inlinePayloads;
+    bool singleProducer;
+    bool process;
+    bool pin;
+    bool json;
+    const char* label;
+    bool hugePages;
+    bool prefault;
+    int numaNode;
+} ringConfig;
+
+/* one per consumer, in memory shared with the parent. */
+typedef struct ringResult
+{
+    int64_t received;
+    int64_t finishedNs;
+    int64_t totalNs;
+    int64_t maxNs;
+    unsigned int checksum;
+    int64_t counts[ HIST_COUNTS ];
+} ringResult;
+
+static int parseWaitStrategy( const char* name )
+{
+    if ( strcmp( name, "yield" ) == 0 )
+        return DISRUPTOR_WAIT_YIELD;
+    if ( strcmp( name, "spin" ) == 0 )
+        return DISRUPTOR_WAIT_SPIN;
+    if ( strcmp( name, "backoff" ) == 0 )
+        return DISRUPTOR_WAIT_BACKOFF;
+    if ( strcmp( name, "block" ) == 0 )
+        return DISRUPTOR_WAIT_BLOCK;
+    return -1;
+}
+
+/* splits a comma separated list in place; returns the number of values. */
+static int parseList( char* list, char* values[] )
+{
+    int count = 0;
+    char* value;
+
+    for ( value = strtok( list, "," ); value && count < MAX_VALUES; value = strtok( NULL, "," ) )
+        values[ count++ ] = value;
+    return count;
+}
+
+static void histRecord( ringResult* r, int64_t ns )
+{
+    int index;
+
+    if ( ns < 0 )
+        ns = 0;
+
+    if ( ns < 2 * HIST_SUB )
+        index = (int)ns;
+    else
+    {
+        int shift = ( 63 - __builtin_clzll( (unsigned long long)ns ) - HIST_SUB_BITS );
+        index = (int)( ( (int64_t)shift << HIST_SUB_BITS ) + ( ns >> shift ) );
+    }
+
+    r->counts[ index ] += 1;
+    r->totalNs += ns;
+    if ( ns > r->maxNs )
+        r->maxNs = ns;
+}
+
+/* the largest latency which would have been counted in 'index'. */
+static int64_t histValue( int index )
+{
+    int shift;
+
+    if ( index < 2 * HIST_SUB )
+        return index;
+
+    shift = ( ( index >> HIST_SUB_BITS ) - 1 );
+    return ( ( ( (int64_t)index - ( (int64_t)shift << HIST_SUB_BITS ) + 1 ) << shift ) - 1 );
+}
+
+static int64_t histPercentile( const ringResult* r, double percentile )
+{
+    int64_t total = 0;
+    int64_t target;
+    int64_t seen = 0;
+    int i;
+
+    for ( i = 0; i < HIST_COUNTS; ++i )
+        total += r->counts[ i ];
+
+    target = (int64_t)( total * percentile / 100.0 + 0.5 );
+    if ( target < 1 )
+        target = 1;
+
+    for ( i = 0; i < HIST_COUNTS; ++i )
+    {
+        seen += r->counts[ i ];
+        if ( seen >= target )
+            return ( histValue( i ) < r->maxNs ? histValue( i ) : r->maxNs );
+    }
+    return r->maxNs;
+}
+
+/* pin this process to the index'th cpu it's allowed to run on, wrapping
+ * around when there are more processes than cpus. */
+static void pinToCpu( int index )
+{
+    cpu_set_t allowed;
+    cpu_set_t pinned;
+    int count;
+    int cpu;
+
+    if ( sched_getaffinity( 0, sizeof( allowed ), &allowed ) != 0 )
+        return;
+
+    count = CPU_COUNT( &allowed );
+    if ( count <= 0 )
+        return;
+
+    index %= count;
+    for ( cpu = 0; cpu < CPU_SETSIZE; ++cpu )
+    {
+        if ( CPU_ISSET( cpu, &allowed ) && index-- == 0 )
+            break;
+    }
+
+    CPU_ZERO( &pinned );
+    CPU_SET( cpu, &pinned );
+    sched_setaffinity( 0, sizeof( pinned ), &pinned );
+}
+
+static int countCpus()
+{
+    cpu_set_t allowed;
+
+    if ( sched_getaffinity( 0, sizeof( allowed ), &allowed ) != 0 )
+        return 1;
+    return CPU_COUNT( &allowed );
+}
+
+static disruptor* openRing( const ringConfig* config, const char* role, int index )
+{
+    disruptorOptions options;
+    disruptor* d;
+    char* username;
+
+    memset( &options, 0, sizeof( options ) );
+    options.waitStrategy = parseWaitStrategy( config->wait );
+    options.inlinePayloads = config->inlinePayloads;
+    options.slots = config->slots;
+    options.singleProducer = config->singleProducer;
+    options.hugePages = config->hugePages;
+    options.prefault = config->prefault;
+    options.lockMemory = config->prefault;
+    options.bindNode = ( config->numaNode >= 0 );
+    options.numaNode = config->numaNode;
+    options.writeOnly = ( strcmp( role, "producer" ) == 0 );
+
+    username = strformat( "%s%d", role, index );
+    d = disruptorCreate( RING_ADDRESS, username, RING_BUFFER_SIZE, &options );
+    strfree( username );
+    return d;
+}
+
+static int runRingProducer( const ringConfig* config, int index, int readyFd, int goFd )
+{
+    char* payload = malloc( config->size );
+    disruptor* d;
+    int64_t i;
+    char c;
+
+    if ( config->pin )
+        pinToCpu( config->consumers + index );
+
+    d = openRing( config, "producer", index );
+    if ( !d || !payload )
+        return 1;
+    memset( payload, index, config->size );
+
+    if ( write( readyFd, "", 1 ) != 1 )
+        return 1;
+    close( readyFd );
+
+    /* wait until everyone's attached. */
+    if ( read( goFd, &c, 1 ) != 0 )
+        return 1;
+    close( goFd );
+
+    for ( i = 0; i < config->messages; )
+    {
+        bool sent;
+
+        if ( config->batch > 1 )
+        {
+            size_t sizes[ MAX_BATCH ];
+            char** ptrs;
+            int n = ( config->messages - i < config->batch ? (int)( config->messages - i ) : config->batch );
+            int j;
+
+            for ( j = 0; j < n; ++j )
+                sizes[ j ] = config->size;
+
+            ptrs = disruptorClaimBatch( d, n, sizes );
+            sent = ( ptrs != NULL );
+            if ( sent )
             {
-                int64_t time = msgGetTimestamp( d, m );
-                int senderId = msgGetSenderId( d, m );
-                const char* sender = msgGetSender( d, m );
-                size_t size = msgGetSize( d, m );
-                char* msg = msgGetData( d, m );
-                printf( "received time=%lld sender=%s size=%d msg=%s\n",
-                        time, sender, (int)size, msg );
+                for ( j = 0; j < n; ++j )
+                    memcpy( ptrs[ j ], payload, config->size );
+                sent = disruptorPublishBatch( d );
+                i += n;
             }
+        }
+        else
+        {
+            sent = disruptorSend( d, payload, config->size );
+            i += 1;
+        }
 
+        if ( !sent )
+        {
+            fprintf( stderr, "producer%d: send failed at %lld\n", index, (long long)i );
             disruptorRelease( d );
+            return 1;
+        }
+    }
+
+    disruptorRelease( d );
+    free( payload );
+    return 0;
+}
+
+/* what -e's handler needs to record each event. */
+typedef struct ringConsumer
+{
+    disruptor* d;
+    ringResult* result;
+    unsigned int checksum;
+} ringConsumer;
+
+static void handleRingEvents( void* ctx, const disruptorEvent* events, int count, bool endOfBatch )
+{
+    ringConsumer* c = ctx;
+    int64_t receivedNs = disruptorGetTimeNs( c->d );
+    int i;
+    size_t j;
+
+    (void)endOfBatch;
+
+    for ( i = 0; i < count; ++i )
+    {
+        histRecord( c->result, receivedNs - events[ i ].timestampNs );
+        for ( j = 0; j < events[ i ].size; ++j )
+            c->checksum += (unsigned char)events[ i ].data[ j ];
+    }
+
+    c->result->received += count;
+}
+
+static int runRingConsumer( const ringConfig* config, int index, ringResult* result, int readyFd )
+{
+    int64_t expected = ( config->producers * config->messages );
+    unsigned int checksum = 0;
+    disruptor* d;
+
+    if ( config->pin )
+        pinToCpu( index );
+
+    d = openRing( config, "consumer", index );
+    if ( !d )
+        return 1;
+    disruptorRecv( d );
+
+    if ( write( readyFd, "", 1 ) != 1 )
+        return 1;
+    close( readyFd );
+
+    if ( config->process )
+    {
+        ringConsumer c;
+        c.d = d;
+        c.result = result;
+        c.checksum = 0;
+
+        while ( result->received < expected )
+            disruptorProcessWait( d, handleRingEvents, &c, (int)config->slots, -1 );
+        checksum = c.checksum;
+    }
+
+    while ( result->received < expected )
+    {
+        disruptorMsg m = disruptorRecvWait( d, -1 );
+        const char* data;
+        size_t i;
+
+        if ( !m )
+            continue;
+
+        /* the time from the send to now, before touching the payload. */
+        histRecord( result, disruptorGetTimeNs( d ) - msgGetTimestampNs( d, m ) );
+
+        data = msgGetData( d, m );
+        for ( i = 0; i < msgGetSize( d, m ); ++i )
+            checksum += (unsigned char)data[ i ];
+
+        result->received += 1;
+    }
+
+    result->finishedNs = nowNs();
+    result->checksum = checksum;
+    disruptorRelease( d );
+    return 0;
+}
+
+static void reportRing( const ringConfig* config, ringResult* results, int64_t startedNs )
+{
+    ringResult* total = &results[ config->consumers ];
+    int64_t finishedNs = startedNs;
+    double elapsed;
+    double msgsPerSec;
+    double bytesPerSec;
+    int64_t p50, p99, p999;
+    int i, j;
+
+    /* merge every consumer's histogram into the spare result at the end. */
+    memset( total, 0, sizeof( *total ) );
+    for ( i = 0; i < config->consumers; ++i )
+    {
+        ringResult* r = &results[ i ];
+
+        for ( j = 0; j < HIST_COUNTS; ++j )
+            total->counts[ j ] += r->counts[ j ];
+        total->received += r->received;
+        total->totalNs += r->totalNs;
+        if ( r->maxNs > total->maxNs )
+            total->maxNs = r->maxNs;
+        if ( r->finishedNs > finishedNs )
+            finishedNs = r->finishedNs;
+    }
+
+    /* every consumer sees every message, so count each message once. */
+    elapsed = ( finishedNs - startedNs ) * 1e-9;
+    msgsPerSec = ( config->producers * config->messages ) / elapsed;
+    bytesPerSec = ( msgsPerSec * config->size );
+    p50 = histPercentile( total, 50.0 );
+    p99 = histPercentile( total, 99.0 );
+    p999 = histPercentile( total, 99.9 );
+
+    fprintf( stderr, "  %.0f msgs/sec, %.1f MB/sec\n", msgsPerSec, bytesPerSec / ( 1024 * 1024 ) );
+    fprintf( stderr, "  latency p50 %lld ns  p99 %lld ns  p99.9 %lld ns  max %lld ns  mean %.0f ns\n",
+            (long long)p50, (long long)p99, (long long)p999, (long long)total->maxNs,
+            (double)total->totalNs / total->received );
+
+    if ( config->json )
+    {
+        fprintf( stdout, "{\"benchmark\":\"ring\",\"label\":\"%s\","
+                "\"producers\":%d,\"consumers\":%d,\"messages\":%lld,\"size\":%d,"
+                "\"slots\":%lld,\"wait\":\"%s\",\"batch\":%d,\"inline\":%s,\"singleProducer\":%s,\"process\":%s,"
+                "\"pinned\":%s,\"cpus\":%d,\"seconds\":%.6f,\"msgsPerSec\":%.0f,\"bytesPerSec\":%.0f,"
+                "\"p50Ns\":%lld,\"p99Ns\":%lld,\"p999Ns\":%lld,\"maxNs\":%lld,\"meanNs\":%.1f}\n",
+                ( config->label ? config->label : "" ),
+                config->producers, config->consumers, (long long)config->messages, (int)config->size,
+                (long long)config->slots, config->wait, config->batch,
+                ( config->inlinePayloads ? "true" : "false" ),
+                ( config->singleProducer ? "true" : "false" ),
+                ( config->process ? "true" : "false" ),
+                ( config->pin ? "true" : "false" ), countCpus(),
+                elapsed, msgsPerSec, bytesPerSec,
+                (long long)p50, (long long)p99, (long long)p999, (long long)total->maxNs,
+                (double)total->totalNs / total->received );
+        fflush( stdout );
+    }
+}
+
+static int runRing( const ringConfig* config )
+{
+    size_t resultsSize = ( ( config->consumers + 1 ) * sizeof( ringResult ) );
+    ringResult* results;
+    pid_t children[ MAX_CHILDREN ];
+    int childrenCount = 0;
+    int failures = 0;
+    int64_t startedNs;
+    int readyFds[2];
+    int goFds[2];
+    char c;
+    int i;
+
+    fprintf( stderr, "%d producers x %lld messages of %d bytes in batches of %d, %d consumers, "
+            "%lld slots, %s wait%s%s%s%s:\n",
+            config->producers, (long long)config->messages, (int)config->size, config->batch,
+            config->consumers, (long long)config->slots, config->wait,
+            ( config->inlinePayloads ? ", inline" : "" ),
+            ( config->singleProducer ? ", single producer" : "" ),
+            ( config->process ? ", process" : "" ),
+            ( config->pin ? ", pinned" : "" ) );
+
+    results = mmap( NULL, resultsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+    if ( results == MAP_FAILED )
+        return 1;
+
+    disruptorKill( RING_ADDRESS );
+
+    if ( pipe( readyFds ) != 0 || pipe( goFds ) != 0 )
+        return 1;
+
+    for ( i = 0; i < config->consumers + config->producers; ++i )
+    {
+        pid_t pid = fork();
+        if ( pid == 0 )
+        {
+            close( readyFds[0] );
+            close( goFds[1] );
+            if ( i < config->consumers )
+                exit( runRingConsumer( config, i, &results[ i ], readyFds[1] ) );
+            else
+                exit( runRingProducer( config, i - config->consumers, readyFds[1], goFds[0] ) );
         }
+        children[ childrenCount++ ] = pid;
+    }
 
-        if ( !child )
+    /* if a child fails to attach, don't wait for it forever. */
+    close( readyFds[1] );
+    for ( i = 0; i < childrenCount; ++i )
+    {
+        if ( read( readyFds[0], &c, 1 ) != 1 )
         {
-            int signal;
-            wait( &signal );
+            fprintf( stderr, "  failed to attach.\n" );
+            for ( i = 0; i < childrenCount; ++i )
+                kill( children[ i ], SIGKILL );
+            while ( wait( NULL ) > 0 )
+                ;
+            disruptorKill( RING_ADDRESS );
+            munmap( results, resultsSize );
+            return 1;
         }
     }
 
-    return 0;
+    /* everyone's attached; let the producers loose. */
+    startedNs = nowNs();
+    close( goFds[0] );
+    close( goFds[1] );
+    close( readyFds[0] );
+
+    for ( i = 0; i < childrenCount; ++i )
+    {
+        int status;
+        if ( wait( &status ) < 0 || !WIFEXITED( status ) || WEXITSTATUS( status ) != 0 )
+        {
+            int j;
+
+            failures += 1;
+            for ( j = 0; j < childrenCount; ++j )
+                kill( children[ j ], SIGKILL );
+        }
+    }
+
+    if ( failures )
+        fprintf( stderr, "  failed.\n" );
+    else
+        reportRing( config, results, startedNs );
+
+    disruptorKill( RING_ADDRESS );
+    munmap( results, resultsSize );
+    return ( failures != 0 );
 }
 
+static int usage( const char* program )
+{
+    fprintf( stderr, "usage: %s [-p producers] [-c consumers] [-n messages per producer] [-s sizes]\n"
+            "       [-r slots] [-w yield|spin|backoff|block] [-b batch] [-i] [-1] [-u] [-e] [-j] [-l label]\n"
+            "       [-H] [-P] [-N node]\n"
+            "       %s inline [messages] [size]\n"
+            "       %s shmap [items]\n"
+            "       %s spsc [messages]\n", program, program, program, program );
+    return 1;
+}
+
+int main(int argc, char** argv)
+{
+    if ( argc > 1 && strcmp( argv[1], "inline" ) == 0 )
+    {
+        int64_t messages = ( argc > 2 ? atoll( argv[2] ) : 10000000 );
+        size_t size = ( argc > 3 ? (size_t)atoi( argv[3] ) : 24 );
+        return runInline( messages, size );
+    }
+
+    if ( argc > 1 && strcmp( argv[1], "shmap" ) == 0 )
+    {
+        int64_t items = ( argc > 2 ? atoll( argv[2] ) : 1000000 );
+        return runShmap( items );
+    }
+
+    if ( argc > 1 && strcmp( argv[1], "spsc" ) == 0 )
+    {
+        int64_t messages = ( argc > 2 ? atoll( argv[2] ) : 1000000 );
+        return runSpsc( messages );
+    }
+
+    {
+        ringConfig config;
+        char sizesList[ 256 ] = "64";
+        char slotsList[ 256 ] = "4096";
+        char waitsList[ 256 ] = "yield";
+        char* sizes[ MAX_VALUES ];
+        char* slots[ MAX_VALUES ];
+        char* waits[ MAX_VALUES ];
+        int sizesCount, slotsCount, waitsCount;
+        int failures = 0;
+        int option;
+        int i, j, k;
+
+        memset( &config, 0, sizeof( config ) );
+        config.producers = 1;
+        config.consumers = 1;
+        config.messages = 1000000;
+        config.batch = 1;
+        config.pin = true;
+        config.numaNode = -1;
+
+        while ( ( option = getopt( argc, argv, "p:c:n:s:r:w:b:i1uejl:HPN:" ) ) != -1 )
+        {
+            switch ( option )
+            {
+            case 'p': config.producers = atoi( optarg ); break;
+            case 'c': config.consumers = atoi( optarg ); break;
+            case 'n': config.messages = atoll( optarg ); break;
+            case 's': snprintf( sizesList, sizeof( sizesList ), "%s", optarg ); break;
+            case 'r': snprintf( slotsList, sizeof( slotsList ), "%s", optarg ); break;
+            case 'w': snprintf( waitsList, sizeof( waitsList ), "%s", optarg ); break;
+            case 'b': config.batch = atoi( optarg ); break;
+            case 'i': config.inlinePayloads = true; break;
+            case '1': config.singleProducer = true; break;
+            case 'u': config.pin = false; break;
+            case 'e': config.process = true; break;
+            case 'j': config.json = true; break;
+            case 'l': config.label = optarg; break;
+            case 'H': config.hugePages = true; break;
+            case 'P': config.prefault = true; break;
+            case 'N': config.numaNode = atoi( optarg ); break;
+            default: return usage( argv[0] );
+            }
+        }
+
+        sizesCount = parseList( sizesList, sizes );
+        slotsCount = parseList( slotsList, slots );
+        waitsCount = parseList( waitsList, waits );
+
+        if ( optind != argc || config.producers <= 0 || config.consumers <= 0 || config.messages <= 0
+                || config.producers + config.consumers > MAX_CHILDREN
+                || config.batch <= 0 || config.batch > MAX_BATCH
+                || ( config.singleProducer && config.producers != 1 )
+                || !sizesCount || !slotsCount || !waitsCount )
+            return usage( argv[0] );
+
+        for ( i = 0; i < sizesCount; ++i )
+        {
+            if ( atoi( sizes[ i ] ) <= 0 || atoi( sizes[ i ] ) > RING_BUFFER_SIZE / ( 4 * config.batch ) )
+                return usage( argv[0] );
+        }
+        for ( i = 0; i < slotsCount; ++i )
+        {
+            if ( atoll( slots[ i ] ) < 0 )
+                return usage( argv[0] );
+        }
+        for ( i = 0; i < waitsCount; ++i )
+        {
+            if ( parseWaitStrategy( waits[ i ] ) < 0 )
+                return usage( argv[0] );
+        }
+
+        /* run every combination of the listed sizes, slots and waits. */
+        for ( i = 0; i < sizesCount; ++i )
+        {
+            for ( j = 0; j < slotsCount; ++j )
+            {
+                for ( k = 0; k < waitsCount; ++k )
+                {
+                    config.size = (size_t)atoi( sizes[ i ] );
+                    config.slots = atoll( slots[ j ] );
+                    config.wait = waits[ k ];
+                    failures += runRing( &config );
+                }
+            }
+        }
+
+        return ( failures != 0 );
+    }
+}
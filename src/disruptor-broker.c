@@ -0,0 +1,35 @@
+#include "shmem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/*-----------------------------------------------------------------------------
+* usage: disruptor-broker [name]
+*
+* Hands out shared memory segments to every process on the machine which
+* runs with $DISRUPTOR_BROKER set to the same name, "disruption" unless
+* another is given.  Each segment is an anonymous memfd, sealed against
+* shrinking, which the broker passes to whoever opens it over an abstract
+* unix socket.  Nothing is created in /dev/shm, so a crash leaves nothing
+* behind, and brokers in different network namespaces never collide.
+*
+* The broker forgets every segment as soon as no process has any of them
+* open, so they vanish when the last participant exits.  Processes which
+* already have a segment mapped keep it if the broker itself exits, but
+* nobody can open anything new until it's restarted.
+*----------------------------------------------------------------------------*/
+
+#define DEFAULT_BROKER_NAME     "disruption"
+
+int main( int argc, char** argv )
+{
+    const char* name = ( argc > 1 ? argv[1] : DEFAULT_BROKER_NAME );
+
+    if ( argc > 2 || ( argc > 1 && argv[1][0] == '-' ) )
+    {
+        fprintf( stderr, "usage: %s [name]\n", argv[0] );
+        return 1;
+    }
+
+    return ( shmemRunBroker( name ) ? 0 : 1 );
+}
@@ -0,0 +1,213 @@
+#define _POSIX_C_SOURCE 200809L
+#include "disruptor.h"
+#include "journal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+
+#include <unistd.h>
+
+/*-----------------------------------------------------------------------------
+* usage: disruptor-journal record [-y none|async|batch|interval] [-i ms]
+*                                 [-s segment MB] [-b batch] [-n messages]
+*                                 [-u username] <address> <dir>
+*        disruptor-journal replay [-f sequence] [-b batch] [-t address]
+*                                 [-u username] <dir>
+*
+* The first form joins an address as a reader and appends every message it
+* receives to the journal in a directory, until it has recorded -n messages
+* or is interrupted.  -y chooses how far each batch is synced before its
+* slots are released, and -i how often the interval policy syncs.
+*
+* The second form reads the journal back, from -f's sequence onwards.  With
+* -t it publishes each payload to that address; otherwise it prints one
+* line per record.
+*----------------------------------------------------------------------------*/
+
+#define DEFAULT_BATCH           256
+#define REPLAY_BUFFER_SIZE      ( 16 * 1024 * 1024 )
+
+static const char* program;
+static volatile sig_atomic_t stopping;
+
+static int usage()
+{
+    fprintf( stderr, "usage: %s record [-y none|async|batch|interval] [-i ms] [-s segment MB] [-b batch]\n"
+            "       [-n messages] [-u username] <address> <dir>\n"
+            "       %s replay [-f sequence] [-b batch] [-t address] [-u username] <dir>\n",
+            program, program );
+    return 1;
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ( ts.tv_sec + ts.tv_nsec * 1e-9 );
+}
+
+static void stop( int sig )
+{
+    (void)sig;
+    stopping = 1;
+}
+
+static int parseSyncPolicy( const char* name )
+{
+    if ( strcmp( name, "none" ) == 0 )
+        return JOURNAL_SYNC_NONE;
+    if ( strcmp( name, "async" ) == 0 )
+        return JOURNAL_SYNC_ASYNC;
+    if ( strcmp( name, "batch" ) == 0 )
+        return JOURNAL_SYNC_BATCH;
+    if ( strcmp( name, "interval" ) == 0 )
+        return JOURNAL_SYNC_INTERVAL;
+    return -1;
+}
+
+static void printEvents( void* ctx, const disruptorEvent* events, int count, bool endOfBatch )
+{
+    int i;
+
+    (void)ctx;
+    (void)endOfBatch;
+
+    for ( i = 0; i < count; ++i )
+    {
+        const disruptorEvent* e = &events[ i ];
+        printf( "%lld %lld %s(%d) %d bytes\n", (long long)e->sequence, (long long)e->timestampNs,
+                e->sender, e->senderId, (int)e->size );
+    }
+}
+
+static int runRecord( int argc, char** argv )
+{
+    journalOptions options;
+    const char* username = "journal";
+    int batch = DEFAULT_BATCH;
+    int64_t limit = 0;
+    int64_t recorded = 0;
+    bool failed = false;
+    journal* j;
+    disruptor* d;
+    double started;
+    int option;
+
+    memset( &options, 0, sizeof( options ) );
+    while ( ( option = getopt( argc, argv, "y:i:s:b:n:u:" ) ) != -1 )
+    {
+        switch ( option )
+        {
+        case 'y': options.syncPolicy = parseSyncPolicy( optarg ); break;
+        case 'i': options.syncIntervalMs = atoll( optarg ); break;
+        case 's': options.segmentSize = atoll( optarg ) * 1024 * 1024; break;
+        case 'b': batch = atoi( optarg ); break;
+        case 'n': limit = atoll( optarg ); break;
+        case 'u': username = optarg; break;
+        default: return usage();
+        }
+    }
+
+    if ( optind != argc - 2 || options.syncPolicy < 0 || batch <= 0 || limit < 0 )
+        return usage();
+
+    j = journalOpen( argv[ optind + 1 ], &options );
+    if ( !j )
+        return 1;
+
+    d = disruptorCreate( argv[ optind ], username, 4096, NULL );
+    if ( !d )
+    {
+        journalRelease( j );
+        return 1;
+    }
+
+    signal( SIGINT, stop );
+    signal( SIGTERM, stop );
+
+    started = now();
+    while ( !stopping && ( limit == 0 || recorded < limit ) )
+    {
+        int64_t n = journalRecord( j, d, batch, 100 );
+        if ( n < 0 )
+        {
+            failed = true;
+            break;
+        }
+        recorded += n;
+    }
+
+    fprintf( stderr, "recorded %lld messages in %.2fs, up to sequence %lld\n", (long long)recorded,
+            now() - started, (long long)journalGetLastSequence( j ) );
+
+    disruptorRelease( d );
+    journalRelease( j );
+    return ( failed ? 1 : 0 );
+}
+
+static int runReplay( int argc, char** argv )
+{
+    const char* username = "replay";
+    const char* target = NULL;
+    int64_t fromSequence = 0;
+    int batch = DEFAULT_BATCH;
+    int64_t replayed;
+    double started;
+    int option;
+
+    while ( ( option = getopt( argc, argv, "f:b:t:u:" ) ) != -1 )
+    {
+        switch ( option )
+        {
+        case 'f': fromSequence = atoll( optarg ); break;
+        case 'b': batch = atoi( optarg ); break;
+        case 't': target = optarg; break;
+        case 'u': username = optarg; break;
+        default: return usage();
+        }
+    }
+
+    if ( optind != argc - 1 || batch <= 0 )
+        return usage();
+
+    started = now();
+    if ( target )
+    {
+        disruptorOptions options;
+        disruptor* d;
+
+        memset( &options, 0, sizeof( options ) );
+        options.writeOnly = true;
+        d = disruptorCreate( target, username, REPLAY_BUFFER_SIZE, &options );
+        if ( !d )
+            return 1;
+        replayed = journalReplayInto( argv[ optind ], fromSequence, d, batch );
+        disruptorRelease( d );
+    }
+    else
+    {
+        replayed = journalReplay( argv[ optind ], fromSequence, printEvents, NULL, batch );
+    }
+
+    if ( replayed < 0 )
+        return 1;
+
+    fprintf( stderr, "replayed %lld messages in %.2fs\n", (long long)replayed, now() - started );
+    return 0;
+}
+
+int main( int argc, char** argv )
+{
+    program = argv[0];
+
+    if ( argc > 1 && strcmp( argv[1], "record" ) == 0 )
+        return runRecord( argc - 1, argv + 1 );
+
+    if ( argc > 1 && strcmp( argv[1], "replay" ) == 0 )
+        return runReplay( argc - 1, argv + 1 );
+
+    return usage();
+}
@@ -0,0 +1,640 @@
+#define _POSIX_C_SOURCE 200809L
+#include "disruptor.h"
+#include "journal.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*-----------------------------------------------------------------------------
+* Soak test: several producer processes push messages through a ring which
+* wraps many times over, while several consumer processes verify that every
+* sequence arrives exactly once and in order.  Each message carries its
+* producer's running count, so the consumers also check that payloads
+* survive the producers' send buffers wrapping around.
+*
+* Meanwhile each churner repeatedly joins under one of a few usernames,
+* sends a burst of messages and leaves again, so that the consumers have to
+* discover new peers while under load, and so that a returning connection
+* has to avoid overwriting payloads it sent last time which are still
+* unread.
+*
+* usage: disruptor-soak [producers] [consumers] [messages per producer] [wait] [slots] [churners] [batch]
+*        disruptor-soak crash
+*        disruptor-soak journal
+*
+* where 'wait' is one of yield, spin, backoff or block, and producers
+* publish 'batch' messages at a time.  disruptor-soak-ordered is the same,
+* built with DISRUPTOR_ORDERED_PUBLISH, so that each producer waits for
+* earlier claims as they used to.
+*
+* The second form kills a producer while it holds a claim it hasn't
+* published, and checks that the reader gives up on the claim and goes on
+* to receive a live producer's messages.
+*
+* The third appends to a journal which only starts writeback after each
+* batch, and checks that journalSync() still leaves none of its pages
+* dirty.  It needs a /var/tmp which is backed by a disk.
+*----------------------------------------------------------------------------*/
+
+#define SOAK_ADDRESS        "soak"
+#ifndef DISRUPTOR_ORDERED_PUBLISH
+# define DISRUPTOR_ORDERED_PUBLISH  0
+#endif
+#define MAX_SENDERS         256
+#define REPORT_INTERVAL     ( 1 << 24 )
+#define MAX_CHILDREN        512
+#define CHURN_ROUNDS        64
+#define CHURN_NAMES         4
+#define CHURN_MESSAGES      1024
+#define MAX_BATCH           1024
+#define CRASH_ADDRESS       "soak-crash"
+#define CRASH_SLOTS         4
+#define CRASH_TIMEOUT_MS    200
+#define JOURNAL_DIR         "/var/tmp/soak-journal-XXXXXX"
+#define JOURNAL_RECORDS     4096
+#define JOURNAL_PAYLOAD     100
+
+static disruptorOptions options;
+static int batch = 1;
+
+static int parseWaitStrategy( const char* name )
+{
+    if ( strcmp( name, "yield" ) == 0 )
+        return DISRUPTOR_WAIT_YIELD;
+    if ( strcmp( name, "spin" ) == 0 )
+        return DISRUPTOR_WAIT_SPIN;
+    if ( strcmp( name, "backoff" ) == 0 )
+        return DISRUPTOR_WAIT_BACKOFF;
+    if ( strcmp( name, "block" ) == 0 )
+        return DISRUPTOR_WAIT_BLOCK;
+    return -1;
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ( ts.tv_sec + ts.tv_nsec * 1e-9 );
+}
+
+static int runProducer( int index, int64_t count, int readyFd, int goFd )
+{
+    disruptor* d;
+    int64_t i;
+
+    /* we're a child of our own, and never receive. */
+    options.writeOnly = true;
+
+    {
+        char* username = strformat( "producer%d", index );
+        d = disruptorCreate( SOAK_ADDRESS, username, 16*1024, &options );
+        strfree( username );
+        if ( !d )
+            return 1;
+    }
+
+    if ( write( readyFd, "", 1 ) != 1 )
+        return 1;
+    close( readyFd );
+
+    /* wait for the consumers. */
+    if ( read( goFd, &i, 1 ) != 0 )
+        return 1;
+    close( goFd );
+
+    for ( i = 0; i < count; )
+    {
+        bool sent;
+
+        if ( batch > 1 )
+        {
+            size_t sizes[ MAX_BATCH ];
+            char** ptrs;
+            int n = ( count - i < batch ? (int)( count - i ) : batch );
+            int j;
+
+            for ( j = 0; j < n; ++j )
+                sizes[ j ] = sizeof( i );
+
+            ptrs = disruptorClaimBatch( d, n, sizes );
+            sent = ( ptrs != NULL );
+            if ( sent )
+            {
+                for ( j = 0; j < n; ++j, ++i )
+                    memcpy( ptrs[ j ], &i, sizeof( i ) );
+                sent = disruptorPublishBatch( d );
+            }
+        }
+        else
+        {
+            sent = disruptorSend( d, (const char*)&i, sizeof( i ) );
+            i += 1;
+        }
+
+        if ( !sent )
+        {
+            fprintf( stderr, "producer%d: send failed at %lld\n", index, (long long)i );
+            disruptorRelease( d );
+            return 1;
+        }
+    }
+
+    disruptorRelease( d );
+    return 0;
+}
+
+static int runChurner( int index, int readyFd, int goFd )
+{
+    disruptor* d;
+    int64_t i;
+    int round;
+
+    options.writeOnly = true;
+
+    if ( write( readyFd, "", 1 ) != 1 )
+        return 1;
+    close( readyFd );
+
+    /* join only once the traffic has started. */
+    if ( read( goFd, &i, 1 ) != 0 )
+        return 1;
+    close( goFd );
+
+    for ( round = 0; round < CHURN_ROUNDS; ++round )
+    {
+        char* username = strformat( "churn%d-%d", index, ( round % CHURN_NAMES ) );
+        d = disruptorCreate( SOAK_ADDRESS, username, 16*1024, &options );
+        strfree( username );
+        if ( !d )
+            return 1;
+
+        /* payloads increase across rounds, so stale ones are caught. */
+        for ( i = 0; i < CHURN_MESSAGES; ++i )
+        {
+            int64_t payload = ( (int64_t)round * CHURN_MESSAGES + i );
+            if ( !disruptorSend( d, (const char*)&payload, sizeof( payload ) ) )
+            {
+                fprintf( stderr, "churn%d: send failed in round %d\n", index, round );
+                disruptorRelease( d );
+                return 1;
+            }
+        }
+
+        disruptorRelease( d );
+    }
+
+    return 0;
+}
+
+static int runConsumer( int index, int producers, int64_t count, int churners, int readyFd )
+{
+    disruptor* d;
+    disruptorMsg m;
+    int64_t total = ( producers * count + (int64_t)churners * CHURN_ROUNDS * CHURN_MESSAGES );
+    int64_t received = 0;
+    int64_t expected = -1;
+    int64_t counts[ MAX_SENDERS ];
+    bool churned[ MAX_SENDERS ];
+    double started;
+    int failed = 0;
+
+    memset( counts, 0, sizeof( counts ) );
+    memset( churned, 0, sizeof( churned ) );
+
+    {
+        char* username = strformat( "consumer%d", index );
+        d = disruptorCreate( SOAK_ADDRESS, username, 16*1024, &options );
+        strfree( username );
+        if ( !d )
+            return 1;
+    }
+
+    /* the first receive attaches us as a reader; only then may producers start. */
+    m = disruptorRecv( d );
+    if ( write( readyFd, "", 1 ) != 1 )
+        return 1;
+    close( readyFd );
+
+    started = now();
+    while ( received < total )
+    {
+        int64_t sequence;
+        int sender;
+
+        if ( !m )
+        {
+            m = disruptorRecvWait( d, -1 );
+            continue;
+        }
+
+        /* every sequence must arrive exactly once, in order. */
+        sequence = msgGetSequence( d, m );
+        if ( expected >= 0 && sequence != expected )
+        {
+            fprintf( stderr, "consumer%d: expected sequence %lld, got %lld\n",
+                    index, (long long)expected, (long long)sequence );
+            failed = 1;
+            break;
+        }
+        expected = sequence + 1;
+
+        sender = msgGetSenderId( d, m );
+        if ( sender < 0 || sender >= MAX_SENDERS )
+        {
+            fprintf( stderr, "consumer%d: bad sender %d at sequence %lld\n",
+                    index, sender, (long long)sequence );
+            failed = 1;
+            break;
+        }
+        /* each producer's messages count up from zero; each churner's
+         * only ever increase. */
+        {
+            const char* name = msgGetSender( d, m );
+            const char* data = msgGetData( d, m );
+            int64_t payload;
+
+            if ( !name || !data || msgGetSize( d, m ) != sizeof( payload ) )
+            {
+                fprintf( stderr, "consumer%d: bad message from %d at sequence %lld\n",
+                        index, sender, (long long)sequence );
+                failed = 1;
+                break;
+            }
+
+            memcpy( &payload, data, sizeof( payload ) );
+            if ( strncmp( name, "churn", 5 ) == 0 )
+            {
+                if ( churned[ sender ] && payload < counts[ sender ] )
+                {
+                    fprintf( stderr, "consumer%d: %s sent %lld after %lld\n",
+                            index, name, (long long)payload, (long long)counts[ sender ] );
+                    failed = 1;
+                    break;
+                }
+                churned[ sender ] = true;
+                counts[ sender ] = ( payload + 1 );
+            }
+            else
+            {
+                if ( payload != counts[ sender ] )
+                {
+                    fprintf( stderr, "consumer%d: sender %d sent %lld, expected %lld\n",
+                            index, sender, (long long)payload, (long long)counts[ sender ] );
+                    failed = 1;
+                    break;
+                }
+                counts[ sender ] += 1;
+            }
+        }
+
+        received += 1;
+        if ( index == 0 && ( received % REPORT_INTERVAL ) == 0 )
+        {
+            double elapsed = ( now() - started );
+            fprintf( stderr, "consumer0: %lld messages, %.0f msgs/sec\n",
+                    (long long)received, received / elapsed );
+        }
+
+        m = disruptorRecv( d );
+    }
+
+    /* each producer must have been heard from exactly 'count' times. */
+    if ( !failed )
+    {
+        int senders = 0;
+        int i;
+
+        for ( i = 0; i < MAX_SENDERS; ++i )
+        {
+            if ( !counts[ i ] || churned[ i ] )
+                continue;
+
+            senders += 1;
+            if ( counts[ i ] != count )
+            {
+                fprintf( stderr, "consumer%d: sender %d sent %lld messages, expected %lld\n",
+                        index, i, (long long)counts[ i ], (long long)count );
+                failed = 1;
+            }
+        }
+
+        if ( senders != producers )
+        {
+            fprintf( stderr, "consumer%d: heard from %d producers, expected %d\n",
+                    index, senders, producers );
+            failed = 1;
+        }
+    }
+
+    if ( !failed )
+    {
+        double elapsed = ( now() - started );
+        fprintf( stderr, "consumer%d: received %lld messages in %.2fs (%.0f msgs/sec)\n",
+                index, (long long)received, elapsed, received / elapsed );
+    }
+
+    disruptorRelease( d );
+    return failed;
+}
+
+static int runCrash()
+{
+    disruptorOptions crashOptions;
+    disruptor* reader;
+    disruptor* laggard;
+    disruptor* live;
+    disruptorMsg m;
+    const char* sender;
+    int received = 0;
+    int lagged = 0;
+    int failed = 0;
+    pid_t pid;
+    int i;
+
+    memset( &crashOptions, 0, sizeof( crashOptions ) );
+    crashOptions.slots = CRASH_SLOTS;
+    crashOptions.claimTimeoutMs = CRASH_TIMEOUT_MS;
+
+    disruptorKill( CRASH_ADDRESS );
+    reader = disruptorCreate( CRASH_ADDRESS, "reader", 4096, &crashOptions );
+    laggard = disruptorCreate( CRASH_ADDRESS, "laggard", 4096, &crashOptions );
+    if ( !reader || !laggard )
+        return 1;
+
+    /* the producers fill the ring and then wait on us. */
+    crashOptions.writeOnly = true;
+
+    /* the last send claims a slot and then waits for one to free up. */
+    pid = fork();
+    if ( pid == 0 )
+    {
+        disruptor* d = disruptorCreate( CRASH_ADDRESS, "doomed", 4096, &crashOptions );
+        for ( i = 0; d && i <= CRASH_SLOTS; ++i )
+            disruptorSend( d, "doomed", 7 );
+        _exit( 1 );
+    }
+
+    sleep( 1 );
+    kill( pid, SIGKILL );
+    waitpid( pid, NULL, 0 );
+
+    live = disruptorCreate( CRASH_ADDRESS, "live", 4096, &crashOptions );
+    if ( !live )
+        return 1;
+
+    for ( i = 0; i < CRASH_SLOTS; ++i )
+    {
+        if ( disruptorRecvWait( reader, 1000 ) )
+            received += 1;
+    }
+
+    /* release those, and find the dead claim.  its slot still holds the
+     * laggard's first message, so the reader mustn't give up on it yet. */
+    if ( disruptorRecvWait( reader, 2 * CRASH_TIMEOUT_MS ) )
+        failed = 1;
+
+    for ( i = 0; i < CRASH_SLOTS; ++i )
+    {
+        m = disruptorRecvWait( laggard, 1000 );
+        if ( m && strcmp( msgGetData( laggard, m ), "doomed" ) == 0 )
+            lagged += 1;
+    }
+    disruptorRecv( laggard );
+
+    /* a laggard that lost its messages would hold the live sender back
+     * for good. */
+    if ( lagged != CRASH_SLOTS )
+    {
+        fprintf( stderr, "crash: the laggard received %d of %d messages\n", lagged, CRASH_SLOTS );
+        fprintf( stderr, "crash: FAILED\n" );
+        return 1;
+    }
+
+    /* this lands behind the dead claim, so the readers only see it once
+     * they give up on that. */
+    if ( !disruptorSend( live, "live", 5 ) )
+        failed = 1;
+
+    m = disruptorRecvWait( reader, 10 * CRASH_TIMEOUT_MS );
+    sender = ( m ? msgGetSender( reader, m ) : NULL );
+    if ( received != CRASH_SLOTS || !sender || strcmp( sender, "live" ) != 0 )
+    {
+        fprintf( stderr, "crash: received %d of %d messages, then %s\n", received, CRASH_SLOTS,
+                ( sender ? sender : "nothing" ) );
+        failed = 1;
+    }
+
+    m = disruptorRecvWait( laggard, 10 * CRASH_TIMEOUT_MS );
+    sender = ( m ? msgGetSender( laggard, m ) : NULL );
+    if ( !sender || strcmp( sender, "live" ) != 0 )
+    {
+        fprintf( stderr, "crash: the laggard then received %s\n", ( sender ? sender : "nothing" ) );
+        failed = 1;
+    }
+
+    disruptorRelease( live );
+    disruptorRelease( laggard );
+    disruptorRelease( reader );
+    disruptorKill( CRASH_ADDRESS );
+
+    fprintf( stderr, "crash: %s\n", ( failed ? "FAILED" : "ok" ) );
+    return failed;
+}
+
+/* the kilobytes of the journal in 'dir' which we have mapped and dirtied,
+ * but which haven't been written back yet. */
+static int64_t getDirtyKb( const char* dir )
+{
+    FILE* f = fopen( "/proc/self/smaps", "r" );
+    char line[ 512 ];
+    bool inJournal = false;
+    int64_t dirty = 0;
+
+    if ( !f )
+        return -1;
+
+    while ( fgets( line, sizeof( line ), f ) )
+    {
+        char field[ 64 ];
+        long long kb;
+
+        /* each mapping starts with a line naming its file. */
+        if ( sscanf( line, "%63s", field ) != 1 )
+            continue;
+        if ( field[ strlen( field ) - 1 ] != ':' )
+            inJournal = ( strstr( line, dir ) != NULL );
+        else if ( inJournal && ( strcmp( field, "Shared_Dirty:" ) == 0 || strcmp( field, "Private_Dirty:" ) == 0 )
+                && sscanf( line, "%*s %lld", &kb ) == 1 )
+            dirty += kb;
+    }
+
+    fclose( f );
+    return dirty;
+}
+
+static int runJournal()
+{
+    journalOptions journalOpts;
+    disruptorEvent e;
+    char dir[] = JOURNAL_DIR;
+    char payload[ JOURNAL_PAYLOAD ];
+    journal* j;
+    int64_t flushed;
+    int64_t synced;
+    int failed = 0;
+    int i;
+
+    if ( !mkdtemp( dir ) )
+    {
+        fprintf( stderr, "journal: couldn't create %s\n", dir );
+        return 1;
+    }
+
+    memset( &journalOpts, 0, sizeof( journalOpts ) );
+    journalOpts.syncPolicy = JOURNAL_SYNC_ASYNC;
+    j = journalOpen( dir, &journalOpts );
+    if ( !j )
+        return 1;
+
+    memset( payload, 'j', sizeof( payload ) );
+    memset( &e, 0, sizeof( e ) );
+    e.data = payload;
+    e.size = sizeof( payload );
+    e.sender = "soak";
+
+    /* flushing only starts writeback, which linux doesn't even do. */
+    for ( i = 0; i < JOURNAL_RECORDS; ++i )
+    {
+        e.sequence = i;
+        if ( !journalAppend( j, &e ) )
+            return 1;
+    }
+    if ( !journalFlush( j ) )
+        return 1;
+    flushed = getDirtyKb( dir );
+
+    /* but a sync must wait for all of it, flushed or not. */
+    if ( !journalSync( j ) )
+        return 1;
+    synced = getDirtyKb( dir );
+
+    if ( flushed <= 0 )
+        fprintf( stderr, "journal: nothing was dirty after the flush, so the sync can't be checked\n" );
+    else if ( synced != 0 )
+    {
+        fprintf( stderr, "journal: %lld kB of %lld were still dirty after the sync\n",
+                (long long)synced, (long long)flushed );
+        failed = 1;
+    }
+
+    journalRelease( j );
+
+    {
+        char* name = strformat( "%s/%08d.journal", dir, 0 );
+        unlink( name );
+        strfree( name );
+        rmdir( dir );
+    }
+
+    fprintf( stderr, "journal: %s\n", ( failed ? "FAILED" : "ok" ) );
+    return failed;
+}
+
+int main( int argc, char** argv )
+{
+    int producers = ( argc > 1 ? atoi( argv[1] ) : 2 );
+    int consumers = ( argc > 2 ? atoi( argv[2] ) : 2 );
+    int64_t count = ( argc > 3 ? atoll( argv[3] ) : 1000000000LL );
+    const char* strategy = ( argc > 4 ? argv[4] : "yield" );
+    int64_t slots = ( argc > 5 ? atoll( argv[5] ) : 0 );
+    int churners = ( argc > 6 ? atoi( argv[6] ) : 1 );
+    pid_t children[ MAX_CHILDREN ];
+    int childrenCount = 0;
+    int failures = 0;
+    int readyFds[2];
+    int goFds[2];
+    char c;
+    int i;
+
+    if ( argc > 1 && strcmp( argv[1], "crash" ) == 0 )
+        return runCrash();
+    if ( argc > 1 && strcmp( argv[1], "journal" ) == 0 )
+        return runJournal();
+
+    options.waitStrategy = parseWaitStrategy( strategy );
+    options.slots = slots;
+    batch = ( argc > 7 ? atoi( argv[7] ) : 1 );
+
+    if ( producers <= 0 || consumers <= 0 || count <= 0 || churners < 0
+            || producers + consumers + churners > MAX_CHILDREN
+            || options.waitStrategy < 0 || slots < 0 || batch <= 0 || batch > MAX_BATCH )
+    {
+        fprintf( stderr, "usage: %s [producers] [consumers] [messages per producer] [yield|spin|backoff|block] [slots] [churners] [batch]\n", argv[0] );
+        return 1;
+    }
+
+    fprintf( stderr, "soak: %d producers x %lld messages in batches of %d, %d consumers, %d churners, %s wait, %s publish\n",
+            producers, (long long)count, batch, consumers, churners, strategy,
+            ( DISRUPTOR_ORDERED_PUBLISH ? "ordered" : "stamped" ) );
+
+    disruptorKill( SOAK_ADDRESS );
+
+    if ( pipe( readyFds ) != 0 || pipe( goFds ) != 0 )
+        return 1;
+
+    /* start everyone at once; peers are discovered as they join. */
+    for ( i = 0; i < producers + consumers + churners; ++i )
+    {
+        pid_t pid = fork();
+        if ( pid == 0 )
+        {
+            close( readyFds[0] );
+            close( goFds[1] );
+            if ( i < producers )
+                exit( runProducer( i, count, readyFds[1], goFds[0] ) );
+            else if ( i < producers + consumers )
+                exit( runConsumer( i - producers, producers, count, churners, readyFds[1] ) );
+            else
+                exit( runChurner( i - producers - consumers, readyFds[1], goFds[0] ) );
+        }
+        children[ childrenCount++ ] = pid;
+    }
+
+    for ( i = 0; i < childrenCount; ++i )
+    {
+        if ( read( readyFds[0], &c, 1 ) != 1 )
+            return 1;
+    }
+
+    /* every consumer is attached; let the producers loose. */
+    close( goFds[0] );
+    close( goFds[1] );
+    close( readyFds[0] );
+    close( readyFds[1] );
+
+    /* reap everyone; if anyone fails, nobody else can finish. */
+    for ( i = 0; i < childrenCount; ++i )
+    {
+        int status;
+        if ( wait( &status ) < 0 || !WIFEXITED( status ) || WEXITSTATUS( status ) != 0 )
+        {
+            int j;
+
+            failures += 1;
+            for ( j = 0; j < childrenCount; ++j )
+                kill( children[ j ], SIGKILL );
+        }
+    }
+
+    disruptorKill( SOAK_ADDRESS );
+
+    fprintf( stderr, "soak: %s\n", ( failures ? "FAILED" : "ok" ) );
+    return ( failures ? 1 : 0 );
+}
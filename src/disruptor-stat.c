@@ -0,0 +1,184 @@
+#define _POSIX_C_SOURCE 200809L
+#include "disruptor.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+
+/*-----------------------------------------------------------------------------
+* usage: disruptor-stat [-d seconds] [-n iterations] <address>
+*
+* Maps an address read-only and, like top, prints each connection's rates
+* every few seconds: messages and bytes published, messages consumed, and
+* how often it had to wait for a slot, found a slot claimed but not yet
+* published, or found its send buffer full.  For readers it also shows how
+* far behind the producers they are, and marks those which have messages
+* waiting but consumed none since the last update as stalled.
+*
+* The monitor never joins the ring or writes to it, so it can watch a ring
+* without changing how it behaves.
+*----------------------------------------------------------------------------*/
+
+#define MAX_STATS           32768
+
+static int usage( const char* program )
+{
+    fprintf( stderr, "usage: %s [-d seconds] [-n iterations] <address>\n", program );
+    return 1;
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ( ts.tv_sec + ts.tv_nsec * 1e-9 );
+}
+
+static void sleepFor( double seconds )
+{
+    struct timespec ts;
+    ts.tv_sec = (time_t)seconds;
+    ts.tv_nsec = (long)( ( seconds - ts.tv_sec ) * 1e9 );
+    nanosleep( &ts, NULL );
+}
+
+/* the previous sample of the connection with the given id, if any.  both
+ * samples are in order of id, so 'at' only ever moves forward. */
+static const disruptorStats* findPrevious( const disruptorStats* prev, int prevCount, int* at, int id )
+{
+    while ( *at < prevCount && prev[ *at ].id < id )
+        *at += 1;
+    if ( *at < prevCount && prev[ *at ].id == id )
+        return &prev[ *at ];
+    return NULL;
+}
+
+static void printStats( disruptorMonitor* m, const char* address,
+        const disruptorStats* cur, int curCount,
+        const disruptorStats* prev, int prevCount, double elapsed )
+{
+    int64_t nowNs = disruptorMonitorGetTimeNs( m );
+    int at = 0;
+    int i;
+
+    printf( "address '%s': %lld slots, cursor %lld, %d connections\n\n", address,
+            (long long)disruptorMonitorGetSlots( m ), (long long)disruptorMonitorGetCursor( m ),
+            curCount );
+    printf( "%5s %-20s %10s %8s %10s %10s %9s %9s %8s %9s\n",
+            "ID", "USERNAME", "PUB/s", "MB/s", "CONS/s", "LAG",
+            "WAIT/s", "STALL/s", "FULL/s", "IDLE" );
+
+    for ( i = 0; i < curCount; ++i )
+    {
+        const disruptorStats* c = &cur[ i ];
+        const disruptorStats* p = findPrevious( prev, prevCount, &at, c->id );
+        disruptorStats zero;
+        char lag[ 32 ];
+        char idle[ 32 ];
+
+        /* someone who joined since the last sample started from nothing. */
+        if ( !p )
+        {
+            memset( &zero, 0, sizeof( zero ) );
+            p = &zero;
+        }
+
+        if ( c->reading )
+            snprintf( lag, sizeof( lag ), "%lld", (long long)c->lag );
+        else
+            snprintf( lag, sizeof( lag ), "-" );
+
+        if ( c->lastActiveNs )
+            snprintf( idle, sizeof( idle ), "%.1fs", ( nowNs - c->lastActiveNs ) * 1e-9 );
+        else
+            snprintf( idle, sizeof( idle ), "never" );
+
+        printf( "%5d %-20s %10.0f %8.2f %10.0f %10s %9.0f %9.0f %8.0f %9s%s\n",
+                c->id, c->username,
+                ( c->published - p->published ) / elapsed,
+                ( c->publishedBytes - p->publishedBytes ) / elapsed / ( 1024 * 1024 ),
+                ( c->consumed - p->consumed ) / elapsed,
+                lag,
+                ( c->claimWaits - p->claimWaits ) / elapsed,
+                ( c->publishStalls - p->publishStalls ) / elapsed,
+                ( c->bufferFulls - p->bufferFulls ) / elapsed,
+                idle,
+                ( c->reading && c->lag > 0 && c->consumed == p->consumed ? "  stalled" : "" ) );
+    }
+
+    fflush( stdout );
+}
+
+int main( int argc, char** argv )
+{
+    disruptorMonitor* m;
+    disruptorStats* cur;
+    disruptorStats* prev;
+    int curCount, prevCount;
+    double delay = 1.0;
+    int iterations = 0;
+    bool clear;
+    double sampled;
+    int option;
+    int i;
+
+    while ( ( option = getopt( argc, argv, "d:n:" ) ) != -1 )
+    {
+        switch ( option )
+        {
+        case 'd': delay = atof( optarg ); break;
+        case 'n': iterations = atoi( optarg ); break;
+        default: return usage( argv[0] );
+        }
+    }
+
+    if ( optind != argc - 1 || delay <= 0 || iterations < 0 )
+        return usage( argv[0] );
+
+    m = disruptorMonitorOpen( argv[ optind ] );
+    if ( !m )
+        return 1;
+
+    cur = malloc( MAX_STATS * sizeof( disruptorStats ) );
+    prev = malloc( MAX_STATS * sizeof( disruptorStats ) );
+    if ( !cur || !prev )
+        return 1;
+
+    /* redraw in place when someone's watching, as top does. */
+    clear = ( isatty( STDOUT_FILENO ) && iterations != 1 );
+
+    prevCount = disruptorMonitorGetStats( m, prev, MAX_STATS );
+    sampled = now();
+
+    for ( i = 0; iterations == 0 || i < iterations; ++i )
+    {
+        double elapsed;
+
+        sleepFor( delay );
+        curCount = disruptorMonitorGetStats( m, cur, MAX_STATS );
+        elapsed = ( now() - sampled );
+        sampled += elapsed;
+
+        if ( clear )
+            printf( "\033[H\033[2J" );
+        else if ( i > 0 )
+            printf( "\n" );
+        printStats( m, argv[ optind ], cur, curCount, prev, prevCount, elapsed );
+
+        /* this sample is the baseline for the next. */
+        {
+            disruptorStats* t = prev;
+            prev = cur;
+            cur = t;
+            prevCount = curCount;
+        }
+    }
+
+    free( cur );
+    free( prev );
+    disruptorMonitorRelease( m );
+    return 0;
+}
@@ -1,57 +1,227 @@
+#define _GNU_SOURCE
 #include "disruptor.h"
 
 #include "util.h"
 #include "zmalloc.h"
 #include "shmem.h"
 #include "shmap.h"
+#include "waiter.h"
+#include "clock.h"
+#include "logger.h"
 #include "atomics.h"
 
+#if DISRUPTOR_USE_REDIS
 #include <hiredis/hiredis.h>
+#endif
 
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 /* constants. */
 #define MAX_ADDRESS_LENGTH      31
-#define MAX_USERNAME_LENGTH     31
-#define MAX_CONNECTIONS         256
-#define MAX_SLOTS               4096
-#define SLOTS_MASK              4095
+#define MAX_USERNAME_LENGTH     DISRUPTOR_MAX_USERNAME_LENGTH
+#define DEFAULT_CONNECTIONS     256
+#define DEFAULT_SLOTS           4096
+#define MAX_CONNECTIONS         32767
+#define MAX_SLOTS               ( (int64_t)1 << 40 )
+#define MAX_NUMA_NODES          1024
+#define SLOT_INLINE_SIZE        40
+#define DEFAULT_CLAIM_TIMEOUT_MS 1000
+
+/* slot flags. */
+#define SLOT_INLINE             (1 << 0)
+
+/* set in a slot's sequence while a producer fills it in, and once it has
+ * been given up on, so that readers skip it. */
+#define STAMP_WRITING           ( (int64_t)1 << 62 )
+#define STAMP_TOMBSTONE         ( (int64_t)1 << 61 )
+#define STAMP_SEQUENCE( s )     ( (s) & ~( STAMP_WRITING | STAMP_TOMBSTONE ) )
+
+/* producer modes. */
+#define PRODUCERS_MULTI         1
+#define PRODUCERS_SINGLE        2
+
+/* how the ring and send buffers are backed. */
+#define MEMORY_NORMAL           1
+#define MEMORY_HUGE_PAGES       2
+
+/* member states. */
+#define MEMBER_FREE             0
+#define MEMBER_JOINING          1
+#define MEMBER_READY            2
+
+/* set in the header of an address which has been killed, so that anyone
+ * still attached knows to reattach to whatever replaces it. */
+#define SESSION_KILLED          -1
+
+/* how often to make sure the address's name still refers to the header
+ * we have mapped. */
+#define SESSION_CHECK_MS        1000
+
+/* worker group states. */
+#define GROUP_EMPTY             0
+#define GROUP_READY             1
+
+/* memory ordering.
+ *
+ * the ring is shared between processes, so every access to it which can
+ * race goes through atomics.h, which says what it orders:
+ *
+ * - a producer fills in a slot and its payload with plain stores, then
+ *   stamps the slot's sequence with a release store.
+ * - a reader scans the stamps with relaxed loads and then issues a single
+ *   acquire fence for the whole batch.
+ * - once done with a batch, a reader release-stores its readCursor.
+ *   producers load-acquire it before reusing a slot or a payload.
+ * - a later pipeline stage load-acquires the readCursors of the stages
+ *   it follows, so it sees anything they changed in place.
+ * - registry entries are published the same way, by a release store of
+ *   their state.
+ *
+ * full fences are only needed where one side stores and then loads what
+ * the other side stored: attaching a reader, rescanning the readers, and
+ * deciding whether to sleep. */
 
 /* types */
 typedef struct cursor
 {
-    volatile int64_t v;
-    volatile int64_t padding[7];
+    int64_t v;
+    int64_t padding[7];
 } cursor;
 
 typedef struct sharedConn
 {
-    volatile cursor readCursor;
+    int64_t readCursor;
+
+    /* the pid of the process reading from this connection, or zero.
+     * producers wait for it to read while this is set. */
+    int64_t active;
+
+    /* the sequences this connection last claimed, so that whoever finds
+     * one stuck knows whose it is. */
+    int64_t claimFirst;
+    int64_t claimLast;
+
+    /* where the payloads still in use lie in our send buffer, as offsets,
+     * so that a connection which restarts under our name can carry on
+     * around them. */
+    int64_t sendHead;
+    int64_t sendTail;
+
+    /* the session those offsets were saved in. */
+    int64_t sendSession;
+
+    /* the pid of the process using this connection, if it waits with
+     * DISRUPTOR_WAIT_BLOCK, or zero.  the header counts those set. */
+    int64_t blocker;
 } sharedConn;
 
+/* counters which only the connection itself writes, for monitors to read. */
+typedef struct sharedStats
+{
+    int64_t published;
+    int64_t publishedBytes;
+    int64_t consumed;
+    int64_t claimWaits;
+    int64_t publishStalls;
+    int64_t bufferFulls;
+
+    /* the tick count of the last publish or fetch. */
+    int64_t lastActive;
+
+    /* messages we found stuck and gave up on. */
+    int64_t recovered;
+} sharedStats;
+
 typedef struct sharedHeader
 {
-    volatile int64_t session;
+    /* chosen by whoever creates the address, so that participants can
+     * tell it apart from any address created under the same name later. */
+    int64_t session;
+
+    /* the geometry of the ring; zero until someone creates the address. */
+    int64_t slots;
+    int64_t maxConnections;
+
+    /* one of PRODUCERS_*, decided along with the geometry.  a single
+     * producer ring belongs to whoever publishes first; 'producer' is
+     * their id plus one. */
+    int64_t producers;
+    int64_t producer;
+
+    /* one of MEMORY_*, also decided along with the geometry. */
+    int64_t memory;
+
+    /* connections using DISRUPTOR_WAIT_BLOCK, and how many of them are
+     * currently asleep on 'signal'. */
+    int64_t blockers;
+    int64_t waiters;
+    int32_t signal;
+
+    /* ids handed out so far; the registry follows the header. */
+    int64_t connectionsCount;
+
+    /* bumped whenever a member becomes ready to be mapped. */
+    int64_t generation;
+
+    /* how everyone converts slot timestamps into nanoseconds. */
+    clockCalibration clock;
 } sharedHeader;
 
+/* a worker group, kept in a shmap keyed by the group's name.  each of its
+ * members claims the sequences after workCursor for itself. */
+typedef struct sharedGroup
+{
+    int64_t workCursor;
+
+    /* GROUP_READY once workCursor has been set, by 'formatter'. */
+    int64_t state;
+    int64_t formatter;
+} sharedGroup;
+
+/* an entry in the registry; one per connection id. */
+typedef struct sharedMember
+{
+    /* MEMBER_READY once the connection's send buffer exists. */
+    int64_t state;
+    char username[ MAX_USERNAME_LENGTH + 1 ];
+
+    /* the process currently connected under this name. */
+    int64_t pid;
+
+    int64_t padding[2];
+} sharedMember;
+
 typedef struct sharedSlot
 {
-    volatile int64_t timestamp;
-    volatile int64_t sender;
-    volatile int64_t size;
-    volatile int64_t offset;
-    volatile int64_t padding[4];
+    /* the sequence which last published into this slot.  written after
+     * every other field, so readers can tell when the slot is ready.  with
+     * multiple producers, it's first marked STAMP_WRITING, so that nobody
+     * gives up on the slot while it's being filled in. */
+    int64_t sequence;
+
+    int64_t timestamp;
+    int16_t sender;
+    int16_t flags;
+    int32_t size;
+
+    /* small payloads live in the rest of the slot's cache line; anything
+     * bigger stays in the sender's send buffer. */
+    union
+    {
+        int64_t offset;
+        char data[ SLOT_INLINE_SIZE ];
+    } payload;
 } sharedSlot;
 
+/* followed by maxConnections sharedConns, maxConnections sharedStats, then
+ * slots sharedSlots. */
 typedef struct sharedRingbuffer
 {
-    volatile cursor publishCursor;
-    volatile cursor claimCursor;
-    volatile sharedConn connections[ MAX_CONNECTIONS ];
-    volatile sharedSlot slots[ MAX_SLOTS ];
+    cursor claimCursor;
 } sharedRingbuffer;
 
 typedef struct sendBuffer
@@ -59,45 +229,224 @@ typedef struct sendBuffer
     shmem* shmem;
     char* start;
     char* end;
+
+    /* for our own buffer, the payloads still referenced by the ring lie
+     * between head and tail, possibly wrapping around the end. */
+    char* head;
     char* tail;
 } sendBuffer;
 
+/* a payload in our send buffer which some reader may not have seen yet. */
+typedef struct pendingPayload
+{
+    int64_t sequence;
+    char* end;
+} pendingPayload;
+
 struct disruptor
 {
     char* address;
     char* username;
     int64_t sendBufferSize;
+    disruptorOptions options;
+
+    /* the session of the address we're attached to, when to next make
+     * sure it's still the one under our address's name, and whether we've
+     * ever been attached at all. */
+    int64_t session;
+    int64_t sessionCheckNs;
+    bool attached;
+
+    /* the usernames of the stages we follow, to follow again if we have
+     * to reattach. */
+    char** followed;
+    int followedCount;
+    int waitStrategy;
+    bool inlinePayloads;
+    bool singleProducer;
+    bool writeOnly;
+    bool hugePages;
+
+    /* the SHMEM_* flags for everything we map, and the node to place the
+     * segments we own on, or -1. */
+    int mapFlags;
+    int numaNode;
+
+    /* as the single producer, the last sequence we claimed. */
+    bool isProducer;
+    int64_t claimed;
 
     int id;
     int connectionsCount;
 
+#if DISRUPTOR_USE_REDIS
     redisContext* redis;
+#endif
 
     shmem* shHeader;
     sharedHeader* header;
+    sharedMember* members;
 
     shmem* shRingbuffer;
     sharedRingbuffer* ringbuffer;
-
-    sendBuffer buffers[ MAX_CONNECTIONS ];
-    char* names[ MAX_CONNECTIONS ];
-
+    sharedConn* connections;
+    sharedStats* stats;
+    sharedSlot* slots;
+
+    /* the geometry of the ring. */
+    int64_t slotsCount;
+    int64_t slotsMask;
+    int maxConnections;
+
+    /* everything sized by the geometry lives as long as the attachment,
+     * and is freed all at once by shutdown(). */
+    zarena* arena;
+
+    /* peers are mapped as they appear; 'generation' is the registry's
+     * generation as of the last time we looked. */
+    sendBuffer* buffers;
+    char** names;
+    int64_t generation;
+
+    /* whether we've received since we last attached. */
+    bool reading;
     int64_t readStart;
     int64_t readEnd;
+
+    /* where disruptorProcess() builds the events it hands out. */
+    disruptorEvent* events;
+    int eventsCount;
+
+    /* the earlier pipeline stages we follow, by connection id. */
+    int* barriers;
+    int barriersCount;
+
+    /* the worker group we belong to, if any, and how many sequences we
+     * claim from it at a time. */
+    shmem* shGroups;
+    shmap* groups;
+    sharedGroup* group;
+    char* groupName;
+    int groupBatch;
+
+    /* the slowest reader, as of the last time we had to look. */
+    int64_t cachedMinimum;
+
+    /* how long to wait on an unpublished slot before giving up on it, and
+     * the slot we're waiting on now, since when. */
+    int64_t claimTimeoutNs;
+    int64_t stuckCursor;
+    int64_t stuckSince;
+
+    /* our published payloads, oldest first, in a ring of slotsCount. */
+    pendingPayload* pending;
+    int64_t pendingFirst;
+    int64_t pendingLast;
+
+    /* the payloads handed out by disruptorClaimBatch(), which are all
+     * published together. */
+    char** batchPtrs;
+    int64_t* batchSizes;
+    int batchCount;
+};
+
+/* a read-only view of someone else's ring. */
+struct disruptorMonitor
+{
+    char* address;
+
+    shmem* shHeader;
+    sharedHeader* header;
+    sharedMember* members;
+
+    shmem* shRingbuffer;
+    sharedRingbuffer* ringbuffer;
+    sharedConn* connections;
+    sharedStats* stats;
+
+    int64_t slotsCount;
+    int maxConnections;
+    bool hugePages;
 };
 
+/* logging; see logger.h. */
+#define handleError( d, ... )   loggerReport( report, d, LOGGER_ERROR, __VA_ARGS__ )
+#define handleWarning( d, ... ) loggerReport( report, d, LOGGER_WARNING, __VA_ARGS__ )
+#define handleInfo( d, ... )    loggerReport( report, d, LOGGER_INFO, __VA_ARGS__ )
+#define handleDebug( d, ... )   loggerReport( report, d, LOGGER_DEBUG, __VA_ARGS__ )
+#define handleTrace( d, ... )   loggerReport( report, d, LOGGER_TRACE, __VA_ARGS__ )
+
 /* forward declarations. */
 static bool startup( disruptor* d );
 static void shutdown( disruptor* d );
-static void handleError( disruptor* d, const char* fmt, ... );
-static void handleInfo( disruptor* d, const char* fmt, ... );
+static void applyOptions( disruptor* d );
+static int64_t newSession();
+static bool checkSession( disruptor* d );
+static bool isStale( disruptor* d );
+static bool isCurrentSession( disruptor* d );
+static bool reattach( disruptor* d );
+static void resumeSendBuffer( disruptor* d );
+static void saveSendBuffer( disruptor* d );
+static void report( disruptor* d, int level, const char* fmt, ... );
+static bool startMonitor( disruptorMonitor* m );
+static void countStat( int64_t* stat, int64_t n );
 static bool isStringValid( const char* str, size_t minSize, size_t maxSize );
+static bool setupGeometry( disruptor* d, int64_t slots, int maxConnections );
+static bool openRegistry( disruptor* d );
+static int getSegmentFlags( disruptor* d, bool owned );
+static int findMember( disruptor* d, const char* username );
+#if DISRUPTOR_USE_REDIS
+static bool registerWithRedis( disruptor* d, bool* wasCreated );
 static redisContext* connectToRedis();
+#else
+static bool registerMember( disruptor* d, bool* wasCreated );
+#endif
+static void refreshMembers( disruptor* d );
+static bool mapSender( disruptor* d, int id );
 static bool mapClient( disruptor* d, unsigned int id );
 static void unmapClient( disruptor* d, unsigned int id );
 static bool waitUntilAvailable( disruptor* d, int64_t cursor );
-static volatile sharedSlot* getSlot( disruptor* d, int64_t cursor );
-static int64_t getMinimumCursor( disruptor* d );
+static sharedSlot* getSlot( disruptor* d, int64_t cursor );
+static int64_t getMinimumCursor( disruptor* d, bool dropDead );
+static int64_t getReaderTimeoutMs( disruptor* d );
+static int64_t claimSequences( disruptor* d, int n );
+static void releaseSequences( disruptor* d, int64_t last );
+static void abandonClaim( disruptor* d, int64_t first, int64_t last );
+static bool becomeProducer( disruptor* d );
+static bool lockClaim( disruptor* d, int64_t first, int n );
+static bool buryClaim( disruptor* d, int64_t sequence, bool writerDead );
+static void checkStuckClaim( disruptor* d, int64_t cursor );
+static int64_t recoverClaims( disruptor* d, int64_t first, int64_t last, bool writerDead );
+static int findClaimant( disruptor* d, int64_t sequence );
+static bool isMemberAlive( disruptor* d, int id );
+static bool isTombstone( disruptor* d, disruptorMsg m );
+#if DISRUPTOR_ORDERED_PUBLISH
+static void waitForEarlierClaims( disruptor* d, int64_t first );
+#endif
+static bool publishSlot( disruptor* d, const char* data, int64_t size, bool isInline );
+static void fillSlot( disruptor* d, int64_t claim, const char* data, int64_t size, bool isInline,
+        int64_t timestamp );
+static void recordPayload( disruptor* d, int64_t claim );
+static char* claimPayload( disruptor* d, size_t size );
+static bool isSizeValid( disruptor* d, size_t size );
+static char* allocPayload( disruptor* d, size_t size );
+static void reclaimPayloads( disruptor* d );
+static int64_t getPublishedCursor( disruptor* d, int64_t cursor, int64_t claimCursor );
+static int64_t getBarrierCursor( disruptor* d, int64_t cursor );
+static void initWaiter( disruptor* d, waiter* w, int64_t timeoutMs );
+static void wakeWaiters( disruptor* d );
+static bool swapBlocker( disruptor* d, int id, int64_t from, int64_t to );
+static void setBlocker( disruptor* d, int64_t pid );
+static void reapBlockers( disruptor* d );
+static void attachReader( disruptor* d, bool wasCreated );
+static bool startReading( disruptor* d );
+static void detachReader( disruptor* d );
+static bool openGroups( disruptor* d );
+static bool fetchBatch( disruptor* d );
+static bool fetchFromRing( disruptor* d );
+static bool claimFromGroup( disruptor* d );
+static void releaseReadCursor( disruptor* d, int64_t cursor );
+static void fillEvent( disruptor* d, disruptorEvent* e, disruptorMsg m );
 
 /*-----------------------------------------------------------------------------
 * Public API definitions.
@@ -105,9 +454,10 @@ static int64_t getMinimumCursor( disruptor* d );
 
 void disruptorKill( const char* address )
 {
+#if DISRUPTOR_USE_REDIS
     redisContext* r;
     redisReply* reply;
-    
+
     r = connectToRedis();
     if ( !r )
     {
@@ -139,48 +489,87 @@ void disruptorKill( const char* address )
         freeReplyObject( reply );
     }
 
-    shmemUnlink( "disruptor:%s", address );
-    shmemUnlink( "disruptor:%s:rb", address );
+    redisFree( r );
+#endif
 
+    /* tell anyone still attached to reattach to whatever replaces it. */
     {
-        int i;
-        for ( i = 0; i < MAX_CONNECTIONS; ++i )
+        shmem* s = shmemOpen( 0, SHMEM_MUST_NOT_CREATE | SHMEM_QUIET, "disruptor:%s", address );
+        sharedHeader* header = shmemGetPtr( s );
+        if ( header )
         {
-            shmemUnlink( "disruptor:%s:%d", address, i );
+            atomicStoreRelease64( &header->session, SESSION_KILLED );
+            atomicBarrier();
+            waiterWakeAll( &header->signal, &header->waiters );
         }
+        shmemClose( s );
     }
+
+    /* the header, then the ring, groups and send buffers. */
+    shmemUnlink( "disruptor:%s", address );
+    shmemUnlinkPrefix( "disruptor:%s:", address );
 }
 
-disruptor* disruptorCreate( const char* address, const char* username, int64_t sendBufferSize )
+disruptor* disruptorCreate( const char* address, const char* username, int64_t sendBufferSize,
+        const disruptorOptions* options )
 {
-    disruptor* d = zcalloc( sizeof(disruptor) );
+    disruptorOptions defaults;
+    disruptor* d;
+
+    if ( !options )
+    {
+        memset( &defaults, 0, sizeof( defaults ) );
+        options = &defaults;
+    }
+
+    d = zcalloc( sizeof(disruptor) );
+    d->arena = zarenaCreate();
     d->address = strclone( address );
     d->username = strclone( username );
     d->sendBufferSize = sendBufferSize;
+    d->options = *options;
     if ( !startup( d ) )
     {
         disruptorRelease( d );
         return NULL;
     }
+    d->attached = true;
     return d;
 }
 
 void disruptorRelease( disruptor* d )
 {
+    int i;
+
     if ( !d )
         return;
 
     shutdown( d );
+    for ( i = 0; i < d->followedCount; ++i )
+        strfree( d->followed[ i ] );
+    zfree( d->followed );
+    strfree( d->groupName );
     strfree( d->address );
     strfree( d->username );
+    zarenaRelease( d->arena );
     zfree( d );
 }
 
 bool disruptorSend( disruptor* d, const char* msg, size_t size )
 {
     char* result;
+
+    if ( !checkSession( d ) )
+        return false;
+
+    /* small messages can skip the send buffer entirely. */
+    if ( d->inlinePayloads && size <= SLOT_INLINE_SIZE )
+        return publishSlot( d, msg, size, true );
     
-    result = disruptorClaim( d, size );
+    if ( !isSizeValid( d, size ) )
+        return false;
+
+    result = claimPayload( d, size );
     if ( !result )
         return false;
 
@@ -231,122 +620,433 @@ bool disruptorVPrintf( disruptor* d, const char* format, va_list ap )
 
 char* disruptorClaim( disruptor* d, size_t size )
 {
-    char* result;
+    if ( !isSizeValid( d, size ) || !checkSession( d ) )
+        return NULL;
+
+    return claimPayload( d, size );
+}
+
+bool disruptorPublish( disruptor* d, char* ptr )
+{
     sendBuffer* buf;
-    
+    int64_t size;
+
     buf = &d->buffers[ d->id ];
+    size = (buf->tail - ptr);
+
+    /* copy small payloads into the slot, and give their space back. */
+    if ( d->inlinePayloads && size <= SLOT_INLINE_SIZE )
+    {
+        buf->tail = ptr;
+        return publishSlot( d, ptr, size, true );
+    }
 
-    /* full? */
-    if ( buf->tail + size > buf->end )
+    return publishSlot( d, ptr, size, false );
+}
+
+char** disruptorClaimBatch( disruptor* d, int n, const size_t sizes[] )
+{
+    char* result;
+    int64_t total = 0;
+    int i;
+
+    /* one batch at a time, and it has to fit in the ring. */
+    assert( d->batchCount == 0 );
+    if ( d->batchCount != 0 || n <= 0 || n > d->slotsCount )
         return NULL;
-    
-    result = buf->tail;
-    buf->tail += size;
-    return result;
+
+    /* the payloads are claimed as one contiguous block, so that we get
+     * all of them or none. */
+    for ( i = 0; i < n; ++i )
+    {
+        if ( !isSizeValid( d, sizes[ i ] ) )
+            return NULL;
+        total += sizes[ i ];
+    }
+
+    if ( !checkSession( d ) )
+        return NULL;
+
+    result = claimPayload( d, total );
+    if ( !result )
+        return NULL;
+
+    for ( i = 0; i < n; ++i )
+    {
+        d->batchPtrs[ i ] = result;
+        d->batchSizes[ i ] = sizes[ i ];
+        result += sizes[ i ];
+    }
+
+    d->batchCount = n;
+    return d->batchPtrs;
 }
 
-bool disruptorPublish( disruptor* d, char* ptr )
+bool disruptorPublishBatch( disruptor* d )
 {
-    int64_t claim;
     sendBuffer* buf;
-    volatile sharedSlot* slot;
+    int64_t first;
+    int64_t last;
+    int64_t timestamp;
+    bool anyShared = false;
+    int n = d->batchCount;
+    int i;
 
-    (void)d;
-    (void)ptr;
     buf = &d->buffers[ d->id ];
 
-    /* increment the claim cursor. */
-    claim = xadd64( &d->ringbuffer->claimCursor.v, 1 );
+    assert( n > 0 );
+    if ( n <= 0 )
+        return false;
+    d->batchCount = 0;
 
-    /* block until the slot is ready. */
-    if ( !waitUntilAvailable( d, claim ) )
+    /* reserve every sequence with a single increment. */
+    last = claimSequences( d, n );
+    if ( !last )
+    {
+        buf->tail = d->batchPtrs[ 0 ];
         return false;
+    }
+    first = ( last - n + 1 );
 
-    /* fill out the slot. */
+    /* the last slot is the furthest ahead, so once it's free they all are. */
+    if ( !waitUntilAvailable( d, last ) )
     {
-        slot = getSlot( d, claim );
-        assert( slot );
-        if ( !slot )
-            return false;
+        abandonClaim( d, first, last );
+        buf->tail = d->batchPtrs[ 0 ];
+        return false;
+    }
 
-        slot->sender = d->id;
-        slot->size = (buf->tail - ptr);
-        slot->offset = (ptr - buf->start);
-        slot->timestamp = rdtsc();
+    /* readers stop at the first slot, so it's the only one to mark. */
+    if ( !d->singleProducer && !lockClaim( d, first, n ) )
+    {
+        buf->tail = d->batchPtrs[ 0 ];
+        return false;
+    }
 
-        /*
-        handleInfo( d, "slot %lld sender=%lld size=%lld offset=%lld timestamp=%lld",
-                claim,
-                slot->sender,
-                slot->size,
-                slot->offset,
-                slot->timestamp );
-                */
+    timestamp = clockTicks();
+    for ( i = 0; i < n; ++i )
+    {
+        bool isInline = ( d->inlinePayloads && d->batchSizes[ i ] <= SLOT_INLINE_SIZE );
+        fillSlot( d, first + i, d->batchPtrs[ i ], d->batchSizes[ i ], isInline, timestamp );
+        if ( !isInline )
+            anyShared = true;
     }
 
+    /* the batch's payloads are released together, once every reader is
+     * past its last slot.  if they were all inlined, none are needed. */
+    if ( anyShared )
+        recordPayload( d, last );
+    else
+        buf->tail = d->batchPtrs[ 0 ];
+
+#if DISRUPTOR_ORDERED_PUBLISH
+    waitForEarlierClaims( d, first );
+#endif
+
+    /* stamp the slots in reverse.  readers stop at the first unstamped
+     * slot, so nobody sees any of the batch until they can see all of it. */
+    for ( i = n - 1; i >= 0; --i )
+        atomicStoreRelease64( &getSlot( d, first + i - 1 )->sequence, first + i );
+    releaseSequences( d, last );
+
+    wakeWaiters( d );
 
-    /* wait until any other producers have published. */
     {
-        int64_t expectedCursor = ( claim - 1 );
-        while ( d->ringbuffer->publishCursor.v < expectedCursor )
-        {
-            atomicYield();
-        }
+        sharedStats* s = &d->stats[ d->id ];
+        int64_t bytes = 0;
+
+        for ( i = 0; i < n; ++i )
+            bytes += d->batchSizes[ i ];
+        countStat( &s->published, n );
+        countStat( &s->publishedBytes, bytes );
+        atomicStoreRelaxed64( &s->lastActive, timestamp );
     }
 
-    /* increment the publish cursor. */
-    d->ringbuffer->publishCursor.v = claim;
-
-    handleInfo( d, "publish %d", (int)claim );
+    handleTrace( d, "publish %d..%d", (int)first, (int)last );
 
     return true;
 }
 
 disruptorMsg disruptorRecv( disruptor* d )
 {
-    volatile sharedConn* conn = &d->ringbuffer->connections[ d->id ];
+    /* between batches, make sure the address is still there. */
+    if ( d->readStart == d->readEnd && !checkSession( d ) )
+        return 0;
+
+    if ( !d->reading && !startReading( d ) )
+        return 0;
+
+    /* hand out the remainder of the current batch, or fetch another. */
+    do
+    {
+        if ( d->readStart == d->readEnd && !fetchBatch( d ) )
+            return 0;
+
+        d->readStart += 1;
+    }
+    while ( isTombstone( d, d->readStart ) );
+
+    return d->readStart;
+}
+
+disruptorMsg disruptorRecvWait( disruptor* d, int64_t timeoutMs )
+{
+    disruptorMsg m;
+    waiter w;
+
+    /* there's nothing to wait on while the address is gone. */
+    m = disruptorRecv( d );
+    if ( m || timeoutMs == 0 || !d->header )
+        return m;
+
+    initWaiter( d, &w, timeoutMs );
+    for ( ;; )
+    {
+        int32_t seen = waiterBegin( &w );
+
+        /* stop waiting on the old header before we reattach. */
+        if ( isStale( d ) )
+        {
+            waiterEnd( &w );
+            return disruptorRecv( d );
+        }
+
+        m = disruptorRecv( d );
+        if ( m )
+            break;
+
+        if ( !waiterIdle( &w, seen ) )
+            break;
+    }
+    waiterEnd( &w );
+
+    return m;
+}
+
+int64_t disruptorProcess( disruptor* d, disruptorHandler handler, void* ctx, int maxBatch )
+{
+    int64_t processed = 0;
+    bool inBatch = false;
+
+    if ( maxBatch <= 0 )
+    {
+        handleError( d, "batch must be at least 1, not %d", maxBatch );
+        return 0;
+    }
+
+    /* a batch never spans more than the ring. */
+    if ( maxBatch > d->slotsCount )
+        maxBatch = (int)d->slotsCount;
 
-    if ( d->readEnd > 0 )
+    if ( d->readStart == d->readEnd && !checkSession( d ) )
+        return 0;
+
+    if ( d->eventsCount < maxBatch )
+    {
+        zfree( d->events );
+        d->events = zmalloc( maxBatch * sizeof(disruptorEvent) );
+        d->eventsCount = maxBatch;
+    }
+
+    if ( !d->reading && !startReading( d ) )
+        return 0;
+
+    /* finish anything disruptorRecv() left, or fetch another batch. */
+    if ( d->readStart == d->readEnd && !fetchBatch( d ) )
+        return 0;
+
+    while ( d->readStart < d->readEnd )
     {
-        if ( d->readStart < d->readEnd )
+        int count = 0;
+
+        while ( count < maxBatch && d->readStart < d->readEnd )
         {
             d->readStart += 1;
-            return d->readStart;
+            if ( !isTombstone( d, d->readStart ) )
+                fillEvent( d, &d->events[ count++ ], d->readStart );
+        }
+
+        /* if the rest of the batch was given up, the handler still needs
+         * to know that it's over. */
+        if ( count || inBatch )
+        {
+            inBatch = ( d->readStart != d->readEnd );
+            handler( ctx, d->events, count, !inBatch );
+            processed += count;
+        }
+    }
+
+    /* release the batch now, rather than when the next one is fetched, so
+     * that nobody waits on us while we're idle. */
+    releaseReadCursor( d, d->readEnd );
+    return processed;
+}
+
+int64_t disruptorProcessWait( disruptor* d, disruptorHandler handler, void* ctx, int maxBatch,
+        int64_t timeoutMs )
+{
+    int64_t processed;
+    waiter w;
+
+    processed = disruptorProcess( d, handler, ctx, maxBatch );
+    if ( processed || timeoutMs == 0 || maxBatch <= 0 || !d->header )
+        return processed;
+
+    initWaiter( d, &w, timeoutMs );
+    for ( ;; )
+    {
+        int32_t seen = waiterBegin( &w );
+
+        if ( isStale( d ) )
+        {
+            waiterEnd( &w );
+            return disruptorProcess( d, handler, ctx, maxBatch );
         }
 
-        if ( d->readEnd > conn->readCursor.v )
-            conn->readCursor.v = d->readEnd;
+        processed = disruptorProcess( d, handler, ctx, maxBatch );
+        if ( processed )
+            break;
 
-        d->readStart = d->readEnd = 0;
+        if ( !waiterIdle( &w, seen ) )
+            break;
     }
+    waiterEnd( &w );
+
+    return processed;
+}
+
+bool disruptorFollow( disruptor* d, const char* username )
+{
+    int id;
+    int i;
 
+    /* our read cursor mustn't already be past theirs. */
+    if ( d->reading )
     {
-        int64_t publishCursor = d->ringbuffer->publishCursor.v;
+        handleError( d, "can't follow '%s' after receiving", username );
+        return false;
+    }
 
-        if ( conn->readCursor.v >= publishCursor )
-            return 0;
+    id = findMember( d, username );
+    if ( id < 0 )
+    {
+        handleError( d, "can't follow '%s'; no such connection", username );
+        return false;
+    }
+    if ( id == d->id )
+    {
+        handleError( d, "can't follow ourselves" );
+        return false;
+    }
+
+    for ( i = 0; i < d->barriersCount; ++i )
+    {
+        if ( d->barriers[ i ] == id )
+            return true;
+    }
+
+    d->barriers[ d->barriersCount++ ] = id;
+
+    for ( i = 0; i < d->followedCount; ++i )
+    {
+        if ( strcmp( d->followed[ i ], username ) == 0 )
+            return true;
+    }
+
+    {
+        char** followed = zmalloc( ( d->followedCount + 1 ) * sizeof( char* ) );
+        if ( d->followedCount )
+            memcpy( followed, d->followed, d->followedCount * sizeof( char* ) );
+        followed[ d->followedCount++ ] = strclone( username );
+        zfree( d->followed );
+        d->followed = followed;
+    }
+    return true;
+}
 
-        d->readStart = conn->readCursor.v + 1;
-        d->readEnd = publishCursor + 1;
-        return d->readStart;
+bool disruptorJoinGroup( disruptor* d, const char* group, int batch )
+{
+    SharedHandle h;
+    sharedGroup* g;
+    int64_t formatter;
+
+    if ( d->reading || d->group )
+    {
+        handleError( d, "can't join group '%s' after receiving", group );
+        return false;
+    }
+
+    if ( !isStringValid( group, 1, SHMAP_MAX_KEY_LENGTH ) )
+    {
+        handleError( d, "invalid length for group '%s'", group );
+        return false;
+    }
+
+    if ( batch <= 0 || batch > d->slotsCount )
+    {
+        handleError( d, "group batch must be between 1 and %lld, not %d", (long long)d->slotsCount, batch );
+        return false;
+    }
+
+    if ( !d->groups && !openGroups( d ) )
+        return false;
+
+    h = shmapGetItem( d->groups, group );
+    if ( !h )
+    {
+        handleError( d, "too many groups" );
+        return false;
+    }
+
+    /* whoever gets here first starts the group from the present.  if they
+     * die before they're done, the first to notice does it instead. */
+    g = shmapGetValue( d->groups, h );
+    formatter = cas64( &g->formatter, 0, getpid() );
+    while ( atomicLoadAcquire64( &g->state ) != GROUP_READY )
+    {
+        if ( formatter == 0 || ( !isProcessAlive( formatter )
+                    && cas64( &g->formatter, formatter, getpid() ) == formatter ) )
+        {
+            atomicStoreRelaxed64( &g->workCursor, atomicLoadRelaxed64( &d->ringbuffer->claimCursor.v ) );
+            atomicStoreRelease64( &g->state, GROUP_READY );
+            shmapSetNew( d->groups, h, false );
+            break;
+        }
+
+        atomicYield();
+        formatter = atomicLoadRelaxed64( &g->formatter );
+    }
+
+    d->group = g;
+    if ( group != d->groupName )
+    {
+        strfree( d->groupName );
+        d->groupName = strclone( group );
     }
+    d->groupBatch = batch;
+    return true;
 }
 
 char* msgGetData( disruptor* d, disruptorMsg m )
 {
-    volatile sharedSlot* slot;
+    sharedSlot* slot;
     sendBuffer* buf;
     
     slot = getSlot( d, m - 1 );
     assert( slot );
+    if ( slot->flags & SLOT_INLINE )
+        return (char*)slot->payload.data;
+
     buf = &d->buffers[ slot->sender ];
+    if ( !buf->start && !mapSender( d, slot->sender ) )
+        return NULL;
 
-    return &buf->start[ slot->offset ];
+    return &buf->start[ slot->payload.offset ];
 }
 
 size_t msgGetSize( disruptor* d, disruptorMsg m )
 {
-    volatile sharedSlot* slot;
+    sharedSlot* slot;
     slot = getSlot( d, m - 1 );
     assert( slot );
 
@@ -362,166 +1062,467 @@ int64_t msgGetSequence( disruptor* d, disruptorMsg m )
 
 int64_t msgGetTimestamp( disruptor* d, disruptorMsg m )
 {
-    volatile sharedSlot* slot;
+    sharedSlot* slot;
     slot = getSlot( d, m - 1 );
     assert( slot );
 
     return slot->timestamp;
 }
 
+int64_t msgGetTimestampNs( disruptor* d, disruptorMsg m )
+{
+    return clockToNs( &d->header->clock, msgGetTimestamp( d, m ) );
+}
+
+int64_t disruptorGetTimeNs( disruptor* d )
+{
+    return clockToNs( &d->header->clock, clockTicks() );
+}
+
 const char* msgGetSender( disruptor* d, disruptorMsg m )
 {
     int id;
 
     id = msgGetSenderId( d, m );
-    assert( id >= 0 && id < MAX_CONNECTIONS );
-    assert( d->names[ id ] != NULL );
+    assert( id >= 0 && id < d->maxConnections );
+    if ( !d->names[ id ] && !mapSender( d, id ) )
+        return NULL;
 
     return d->names[ id ];
 }
 
 int msgGetSenderId( disruptor* d, disruptorMsg m )
 {
-    volatile sharedSlot* slot;
+    sharedSlot* slot;
     slot = getSlot( d, m - 1 );
     assert( slot );
 
     return (int)slot->sender;
 }
 
-/*-----------------------------------------------------------------------------
-* File-local function definitions.
-*----------------------------------------------------------------------------*/
+disruptorMonitor* disruptorMonitorOpen( const char* address )
+{
+    disruptorMonitor* m = zcalloc( sizeof(disruptorMonitor) );
+    m->address = strclone( address );
+    if ( !startMonitor( m ) )
+    {
+        disruptorMonitorRelease( m );
+        return NULL;
+    }
+    return m;
+}
 
-static bool startup( disruptor* d )
+void disruptorMonitorRelease( disruptorMonitor* m )
 {
-    bool wasCreated = false;
-    redisContext* r;
-    redisReply* reply;
+    if ( !m )
+        return;
 
-    /* validate inputs. */
+    shmemClose( m->shRingbuffer );
+    shmemClose( m->shHeader );
+    strfree( m->address );
+    zfree( m );
+}
+
+int disruptorMonitorGetStats( disruptorMonitor* m, disruptorStats stats[], int maxStats )
+{
+    int64_t claimCursor = disruptorMonitorGetCursor( m );
+    int64_t count;
+    int filled = 0;
+    int i;
+
+    count = atomicLoadRelaxed64( &m->header->connectionsCount );
+    if ( count > m->maxConnections )
+        count = m->maxConnections;
+
+    for ( i = 0; i < count && filled < maxStats; ++i )
     {
-        if ( !isStringValid( d->address, 1, MAX_ADDRESS_LENGTH ) )
-        {
-            handleError( d, "invalid length for string '%s'", d->address );
-            return false;
-        }
+        sharedMember* member = &m->members[ i ];
+        sharedConn* conn = &m->connections[ i ];
+        sharedStats* s = &m->stats[ i ];
+        disruptorStats* out = &stats[ filled ];
+        int64_t lastActive;
+
+        /* the username is only complete once the member is ready. */
+        if ( atomicLoadAcquire64( &member->state ) != MEMBER_READY )
+            continue;
+
+        memset( out, 0, sizeof( *out ) );
+        out->id = i;
+        memcpy( out->username, member->username, sizeof( out->username ) );
+        out->username[ MAX_USERNAME_LENGTH ] = '\0';
+
+        out->reading = ( atomicLoadRelaxed64( &conn->active ) != 0 );
+        if ( out->reading )
+            out->lag = ( claimCursor - atomicLoadRelaxed64( &conn->readCursor ) );
+
+        out->published = atomicLoadRelaxed64( &s->published );
+        out->publishedBytes = atomicLoadRelaxed64( &s->publishedBytes );
+        out->consumed = atomicLoadRelaxed64( &s->consumed );
+        out->claimWaits = atomicLoadRelaxed64( &s->claimWaits );
+        out->publishStalls = atomicLoadRelaxed64( &s->publishStalls );
+        out->bufferFulls = atomicLoadRelaxed64( &s->bufferFulls );
+        out->recovered = atomicLoadRelaxed64( &s->recovered );
+        out->pid = atomicLoadRelaxed64( &member->pid );
+
+        lastActive = atomicLoadRelaxed64( &s->lastActive );
+        if ( lastActive )
+            out->lastActiveNs = clockToNs( &m->header->clock, lastActive );
+
+        filled += 1;
+    }
 
-        if ( !isStringValid( d->username, 1, MAX_USERNAME_LENGTH ) )
-        {
-            handleError( d, "invalid length for string '%s'", d->username );
-            return false;
-        }
-    }
+    return filled;
+}
 
-    /* connect to redis. */
-    r = d->redis = connectToRedis();
-    if ( !r )
+int64_t disruptorMonitorGetCursor( disruptorMonitor* m )
+{
+    return atomicLoadRelaxed64( &m->ringbuffer->claimCursor.v );
+}
+
+int64_t disruptorMonitorGetSlots( disruptorMonitor* m )
+{
+    return m->slotsCount;
+}
+
+int64_t disruptorMonitorGetTimeNs( disruptorMonitor* m )
+{
+    return clockToNs( &m->header->clock, clockTicks() );
+}
+
+/*-----------------------------------------------------------------------------
+* File-local function definitions.
+*----------------------------------------------------------------------------*/
+
+static int64_t newSession()
+{
+    int64_t session = ( ( clockTicks() << 20 ) ^ getpid() ) & INT64_MAX;
+    return ( session > 0 ? session : 1 );
+}
+
+static void resumeSendBuffer( disruptor* d )
+{
+    sendBuffer* buf = &d->buffers[ d->id ];
+    sharedConn* conn = &d->connections[ d->id ];
+    int64_t size = ( buf->end - buf->start );
+    int64_t head = atomicLoadRelaxed64( &conn->sendHead );
+    int64_t tail = atomicLoadRelaxed64( &conn->sendTail );
+
+    /* nothing was in use, or only by readers of an earlier session who
+     * are long gone; start afresh. */
+    if ( head == tail || atomicLoadRelaxed64( &conn->sendSession ) != d->session )
+        return;
+
+    /* otherwise carry on after the last payload, and treat everything from
+     * the oldest one in use up to it as one payload which every reader is
+     * done with once they're past the point where we joined.  if we can't
+     * make sense of the offsets, assume the whole buffer is in use. */
+    if ( head < 0 || head > size || tail < 0 || tail > size )
+        head = tail = 0;
+
+    buf->head = ( buf->start + head );
+    buf->tail = ( buf->start + tail );
+    d->pending[ 0 ].sequence = atomicLoadRelaxed64( &d->ringbuffer->claimCursor.v );
+    d->pending[ 0 ].end = buf->tail;
+    d->pendingLast = 1;
+    handleDebug( d, "resuming send buffer at %lld, %lld bytes in use", (long long)tail,
+            (long long)( tail > head ? tail - head : size - head + tail ) );
+}
+
+static void saveSendBuffer( disruptor* d )
+{
+    sendBuffer* buf = &d->buffers[ d->id ];
+    sharedConn* conn = &d->connections[ d->id ];
+
+    /* only we write these; they're read by whoever next uses our name. */
+    atomicStoreRelaxed64( &conn->sendHead, buf->head - buf->start );
+    atomicStoreRelaxed64( &conn->sendTail, buf->tail - buf->start );
+    atomicStoreRelaxed64( &conn->sendSession, d->session );
+}
+
+static void applyOptions( disruptor* d )
+{
+    const disruptorOptions* options = &d->options;
+
+    d->waitStrategy = options->waitStrategy;
+    d->inlinePayloads = options->inlinePayloads;
+    d->singleProducer = options->singleProducer;
+    d->writeOnly = options->writeOnly;
+    d->hugePages = options->hugePages;
+    d->mapFlags = ( options->prefault ? SHMEM_PREFAULT : 0 ) | ( options->lockMemory ? SHMEM_LOCK : 0 );
+    d->numaNode = ( options->bindNode ? options->numaNode : -1 );
+    d->slotsCount = options->slots;
+    d->maxConnections = options->maxConnections;
+    d->claimTimeoutNs = ( options->claimTimeoutMs ? options->claimTimeoutMs : DEFAULT_CLAIM_TIMEOUT_MS ) * 1000 * 1000;
+    d->stuckCursor = -1;
+}
+
+static bool checkSession( disruptor* d )
+{
+    if ( d->header && !isStale( d ) )
+        return true;
+    return reattach( d );
+}
+
+static bool isStale( disruptor* d )
+{
+    int64_t now;
+
+    if ( atomicLoadRelaxed64( &d->header->session ) != d->session )
+        return true;
+
+    /* an address can also be unlinked and created again without being
+     * killed, so every so often make sure our header is still the one
+     * under its name. */
+    now = clockToNs( &d->header->clock, clockTicks() );
+    if ( now < d->sessionCheckNs )
+        return false;
+    d->sessionCheckNs = now + (int64_t)SESSION_CHECK_MS * 1000 * 1000;
+
+    /* and stop counting blocked connections whose process died, or the
+     * rest of us would go on waking nobody. */
+    reapBlockers( d );
+    return !isCurrentSession( d );
+}
+
+static bool isCurrentSession( disruptor* d )
+{
+    shmem* s;
+    sharedHeader* header;
+    bool result;
+
+    s = shmemOpen( sizeof(sharedHeader), SHMEM_MUST_NOT_CREATE | SHMEM_READ_ONLY | SHMEM_QUIET,
+            "disruptor:%s", d->address );
+    header = shmemGetPtr( s );
+    result = ( header && atomicLoadRelaxed64( &header->session ) == d->session );
+    shmemClose( s );
+    return result;
+}
+
+static bool reattach( disruptor* d )
+{
+    bool result;
+    int i;
+
+    if ( d->header )
+        handleWarning( d, "the address was killed or replaced; reattaching" );
+
+    shutdown( d );
+    d->reading = false;
+    d->readStart = d->readEnd = 0;
+    d->barriersCount = 0;
+    d->isProducer = false;
+    d->claimed = 0;
+    d->cachedMinimum = 0;
+    d->pendingFirst = d->pendingLast = 0;
+    d->batchCount = 0;
+    d->generation = 0;
+
+    /* until someone creates the address again, try again every time. */
+    result = startup( d );
+    if ( !result )
     {
-        handleError( d, "could not connect to redis" );
+        shutdown( d );
         return false;
     }
 
-    /* determine a mapping for this connection. */
-    {
-        int id = -1;
+    /* follow the same stages, which may have different ids now. */
+    for ( i = 0; i < d->followedCount && result; ++i )
+        result = disruptorFollow( d, d->followed[ i ] );
 
-        /* try to fetch an existing mapping. */
-        {
-            reply = redisCommand( r, "GET disruptor:%s:connections:%s:id", d->address, d->username );
-            if ( reply->type == REDIS_REPLY_STRING )
-            {
-                id = atoi( reply->str );
-            }
-            freeReplyObject( reply );
-        }
+    if ( result && d->groupName )
+        result = disruptorJoinGroup( d, d->groupName, d->groupBatch );
 
-        /* if no mapping exists, then assign a new one. */
-        if ( id < 0 )
-        {
-            {
-                reply = redisCommand( r, "INCR disruptor:%s:connectionsCount", d->address );
-                if ( reply->type == REDIS_REPLY_INTEGER )
-                    id = ( reply->integer - 1 );
-                freeReplyObject( reply );
-            }
+    if ( result )
+        handleInfo( d, "reattached as #%d", d->id );
+    return result;
+}
 
-            assert( id >= 0 );
-            if ( id < 0 )
-            {
-                handleError( d, "could not determine mapping for username '%s'", d->username );
-                return false;
-            }
+static bool startup( disruptor* d )
+{
+    bool wasCreated = false;
 
-            wasCreated = true;
+    /* setupGeometry() replaces what we asked for with what the address
+     * has, so start from the options every time. */
+    applyOptions( d );
 
-            {
-                reply = redisCommand( r, "SET disruptor:%s:connections:%s:id %d", d->address, d->username, id );
-                freeReplyObject( reply );
-            }
+    /* validate inputs. */
+    {
+        if ( !isStringValid( d->address, 1, MAX_ADDRESS_LENGTH ) )
+        {
+            handleError( d, "invalid length for string '%s'", d->address );
+            return false;
+        }
 
-            {
-                reply = redisCommand( r, "SET disruptor:%s:%d:username %s", d->address, id, d->username );
-                freeReplyObject( reply );
-            }
+        if ( !isStringValid( d->username, 1, MAX_USERNAME_LENGTH ) )
+        {
+            handleError( d, "invalid length for string '%s'", d->username );
+            return false;
         }
 
-        d->id = id;
-    }
+        /* the DISRUPTOR_WAIT_* values are the WAITER_* values. */
+        if ( !waiterIsValid( d->waitStrategy ) )
+        {
+            handleError( d, "invalid wait strategy %d", d->waitStrategy );
+            return false;
+        }
 
-    /* determine the connection count. */
-    {
-        d->connectionsCount = 0;
+        if ( d->slotsCount < 0 || d->slotsCount > MAX_SLOTS
+                || ( d->slotsCount & ( d->slotsCount - 1 ) ) != 0 )
+        {
+            handleError( d, "slots must be a power of two, not %lld", (long long)d->slotsCount );
+            return false;
+        }
 
-        reply = redisCommand( r, "GET disruptor:%s:connectionsCount", d->address, d->username );
-        if ( reply->type == REDIS_REPLY_STRING )
-            d->connectionsCount = atoi( reply->str );
-        freeReplyObject( reply );
+        if ( d->maxConnections < 0 || d->maxConnections > MAX_CONNECTIONS )
+        {
+            handleError( d, "maxConnections must be at most %d", MAX_CONNECTIONS );
+            return false;
+        }
 
-        if ( d->connectionsCount <= 0 )
+        if ( d->numaNode < -1 || d->numaNode >= MAX_NUMA_NODES )
         {
-            handleError( d, "could not determine the connection count." );
+            handleError( d, "NUMA node must be below %d, not %d", MAX_NUMA_NODES, d->numaNode );
             return false;
         }
     }
 
-    handleInfo( d, "id=%d total=%d", d->id, d->connectionsCount );
-
     /* open the shared header. */
     {
-        d->shHeader = shmemOpen( sizeof(sharedHeader), SHMEM_DEFAULT, "disruptor:%s", d->address );
+        /* once attached, only ever reattach to an address someone else
+         * has created again; never bring a killed one back ourselves. */
+        d->shHeader = shmemOpen( sizeof(sharedHeader),
+                ( d->attached ? SHMEM_MUST_NOT_CREATE | SHMEM_QUIET : SHMEM_DEFAULT ),
+                "disruptor:%s", d->address );
         d->header = shmemGetPtr( d->shHeader );
+        if ( !d->header )
+        {
+            if ( !d->attached )
+                handleError( d, "could not open the shared header" );
+            return false;
+        }
+
+        /* the first to open the address names its session.  if it's been
+         * killed, we opened it just before it was unlinked. */
+        cas64( &d->header->session, 0, newSession() );
+        d->session = atomicLoadRelaxed64( &d->header->session );
+        if ( d->session == SESSION_KILLED )
+        {
+            handleError( d, "the address is being killed" );
+            shmemClose( d->shHeader );
+            d->shHeader = NULL;
+            d->header = NULL;
+            return false;
+        }
+
+        /* agree on what the timestamps mean. */
+        clockShare( &d->header->clock );
+        if ( !clockIsInvariant() )
+            handleWarning( d, "the tick counter isn't invariant; timestamps may drift" );
     }
 
+    /* agree on the geometry of the ring. */
+    if ( !setupGeometry( d, d->slotsCount, d->maxConnections ) )
+        return false;
+
+    if ( !openRegistry( d ) )
+        return false;
+
+    /* determine a mapping for this connection. */
+#if DISRUPTOR_USE_REDIS
+    if ( !registerWithRedis( d, &wasCreated ) )
+        return false;
+#else
+    if ( !registerMember( d, &wasCreated ) )
+        return false;
+#endif
+
+    handleDebug( d, "id=%d total=%d", d->id, (int)atomicLoadRelaxed64( &d->header->connectionsCount ) );
+
     /* open the shared ringbuffer. */
     {
-        d->shRingbuffer = shmemOpen( sizeof(sharedRingbuffer), SHMEM_DEFAULT, "disruptor:%s:rb", d->address );
+        int64_t size;
+
+        size = sizeof(sharedRingbuffer)
+            + d->maxConnections * sizeof(sharedConn)
+            + d->maxConnections * sizeof(sharedStats)
+            + d->slotsCount * sizeof(sharedSlot);
+
+        d->shRingbuffer = shmemOpen( size, getSegmentFlags( d, true ), "disruptor:%s:rb", d->address );
         d->ringbuffer = shmemGetPtr( d->shRingbuffer );
+        if ( !d->ringbuffer )
+        {
+            handleError( d, "could not open the shared ringbuffer" );
+            return false;
+        }
+
+        d->connections = (sharedConn*)( d->ringbuffer + 1 );
+        d->stats = (sharedStats*)( d->connections + d->maxConnections );
+        d->slots = (sharedSlot*)( d->stats + d->maxConnections );
     }
 
+    /* if our predecessor under this name died mid-publish, nobody else
+     * would ever give up on its claim, since it looks like ours. */
+    if ( !wasCreated && !d->singleProducer )
     {
-        int i;
+        sharedConn* conn = &d->connections[ d->id ];
+        int64_t first = atomicLoadRelaxed64( &conn->claimFirst );
+        int64_t last = atomicLoadRelaxed64( &conn->claimLast );
+
+        if ( first > 0 && recoverClaims( d, first, last, true ) )
+            handleWarning( d, "gave up on %d..%d, left claimed by our predecessor", (int)first, (int)last );
+    }
+    atomicStoreRelaxed64( &d->members[ d->id ].pid, getpid() );
+
+    /* from now on, everyone who makes progress must check for sleepers.
+     * if our predecessor died blocking, it's still counted; take over. */
+    setBlocker( d, ( d->waitStrategy == DISRUPTOR_WAIT_BLOCK ? getpid() : 0 ) );
+
+    d->buffers = zarenaAlloc( d->arena, d->maxConnections * sizeof( sendBuffer ) );
+    d->names = zarenaAlloc( d->arena, d->maxConnections * sizeof( char* ) );
+    d->pending = zarenaAlloc( d->arena, d->slotsCount * sizeof( pendingPayload ) );
+    d->batchPtrs = zarenaAlloc( d->arena, d->slotsCount * sizeof( char* ) );
+    d->batchSizes = zarenaAlloc( d->arena, d->slotsCount * sizeof( int64_t ) );
+    d->barriers = zarenaAlloc( d->arena, d->maxConnections * sizeof( int ) );
+
+    {
+        shmem* created = NULL;
 
         /* create the shared memory sendBuffer. */
         if ( wasCreated )
         {
-            shmem* s;
-            handleInfo( d, "creating %d", d->id );
-            s = shmemOpen( d->sendBufferSize, SHMEM_MUST_CREATE, "disruptor:%s:%d", d->address, d->id );
-            shmemClose( s );
+            handleDebug( d, "creating %d", d->id );
+            created = shmemOpen( d->sendBufferSize, SHMEM_MUST_CREATE | getSegmentFlags( d, true ),
+                    "disruptor:%s:%d", d->address, d->id );
+            if ( !created )
+                return false;
+
+            /* let everyone else map us. */
+            atomicStoreRelease64( &d->members[ d->id ].state, MEMBER_READY );
+            xadd64( &d->header->generation, 1 );
         }
 
-        /* map each connection. */
-        for ( i = 0; i < d->connectionsCount; ++i )
+        /* map everyone who's ready; the rest are mapped as they appear.  a
+         * brokered segment only lives while someone has it open, so keep
+         * ours open until then. */
+        refreshMembers( d );
+        shmemClose( created );
+        if ( !d->buffers[ d->id ].start )
         {
-            if ( !mapClient( d, i ) )
-            {
-                handleError( d, "could not map client %d", i );
-                return false;
-            }
+            handleError( d, "could not map our own send buffer" );
+            return false;
         }
+
+        /* a previous connection under our name may have left payloads in
+         * the send buffer which haven't been read yet. */
+        if ( !wasCreated )
+            resumeSendBuffer( d );
     }
 
+    /* hold the producers back from the moment we join, so that nothing
+     * published after that is lost before we first receive. */
+    if ( !d->writeOnly )
+        attachReader( d, wasCreated );
+
     return true;
 }
 
@@ -529,48 +1530,124 @@ static void shutdown( disruptor* d )
 {
     int i;
 
-    for ( i = 0; i < MAX_CONNECTIONS; ++i )
-        unmapClient( d, i );
+    if ( d->ringbuffer )
+    {
+        detachReader( d );
+        setBlocker( d, 0 );
+    }
+
+    if ( d->buffers && d->names )
+    {
+        for ( i = 0; i < d->maxConnections; ++i )
+            unmapClient( d, i );
+    }
+
+    d->buffers = NULL;
+    d->names = NULL;
 
+#if DISRUPTOR_USE_REDIS
     if ( d->redis )
     {
         redisFree( d->redis );
         d->redis = NULL;
     }
+#endif
 
     shmemClose( d->shRingbuffer );
     d->shRingbuffer = NULL;
     d->ringbuffer = NULL;
+    d->connections = NULL;
+    d->slots = NULL;
+
+    d->pending = NULL;
+    d->batchPtrs = NULL;
+    d->batchSizes = NULL;
+    d->barriers = NULL;
+    zarenaClear( d->arena );
+    zfree( d->events );
+    d->events = NULL;
+    d->eventsCount = 0;
+
+    shmapRelease( d->groups );
+    d->groups = NULL;
+    shmemClose( d->shGroups );
+    d->shGroups = NULL;
+    d->group = NULL;
 
     shmemClose( d->shHeader );
     d->shHeader = NULL;
     d->header = NULL;
+    d->members = NULL;
 }
 
-static void handleError( disruptor* d, const char* fmt, ... )
+static void report( disruptor* d, int level, const char* fmt, ... )
 {
+    char source[ 128 ];
     va_list ap;
-    va_start( ap, fmt );
+
     if ( d )
-        fprintf( stderr, "disruptor '%s/%s' error: ", d->address, d->username );
+        snprintf( source, sizeof( source ), "disruptor '%s/%s'", d->address, d->username );
     else
-        fprintf( stderr, "disruptor error: " );
-    vfprintf( stderr, fmt, ap );
-    fprintf( stderr, "\n" );
+        snprintf( source, sizeof( source ), "disruptor" );
+
+    va_start( ap, fmt );
+    loggerWritev( level, source, fmt, ap );
     va_end( ap );
 }
 
-static void handleInfo( disruptor* d, const char* fmt, ... )
+static bool startMonitor( disruptorMonitor* m )
 {
-    va_list ap;
-    va_start( ap, fmt );
-    if ( d )
-        fprintf( stdout, "disruptor '%s/%s' info: ", d->address, d->username );
-    else
-        fprintf( stdout, "disruptor info: " );
-    vfprintf( stdout, fmt, ap );
-    fprintf( stdout, "\n" );
-    va_end( ap );
+    /* find out how big the address is. */
+    {
+        m->shHeader = shmemOpen( sizeof(sharedHeader), SHMEM_READ_ONLY, "disruptor:%s", m->address );
+        m->header = shmemGetPtr( m->shHeader );
+        if ( !m->header )
+        {
+            handleError( NULL, "could not open address '%s'", m->address );
+            return false;
+        }
+
+        m->slotsCount = atomicLoadAcquire64( &m->header->slots );
+        m->maxConnections = (int)atomicLoadAcquire64( &m->header->maxConnections );
+        m->hugePages = ( atomicLoadRelaxed64( &m->header->memory ) == MEMORY_HUGE_PAGES );
+        if ( !m->slotsCount || !m->maxConnections )
+        {
+            handleError( NULL, "address '%s' hasn't been set up yet", m->address );
+            return false;
+        }
+    }
+
+    /* map the registry along with the header, as openRegistry() does. */
+    {
+        shmemClose( m->shHeader );
+        m->shHeader = shmemOpen( sizeof(sharedHeader) + m->maxConnections * sizeof(sharedMember),
+                SHMEM_READ_ONLY, "disruptor:%s", m->address );
+        m->header = shmemGetPtr( m->shHeader );
+        if ( !m->header )
+            return false;
+        m->members = (sharedMember*)( m->header + 1 );
+    }
+
+    /* then the ring, to read the cursors and stats. */
+    {
+        int64_t size;
+
+        size = sizeof(sharedRingbuffer)
+            + m->maxConnections * sizeof(sharedConn)
+            + m->maxConnections * sizeof(sharedStats)
+            + m->slotsCount * sizeof(sharedSlot);
+
+        m->shRingbuffer = shmemOpen( size, SHMEM_READ_ONLY | ( m->hugePages ? SHMEM_HUGE_PAGES : 0 ),
+                "disruptor:%s:rb", m->address );
+        m->ringbuffer = shmemGetPtr( m->shRingbuffer );
+        if ( !m->ringbuffer )
+            return false;
+
+        m->connections = (sharedConn*)( m->ringbuffer + 1 );
+        m->stats = (sharedStats*)( m->connections + m->maxConnections );
+    }
+
+    return true;
 }
 
 static bool isStringValid( const char* str, size_t minSize, size_t maxSize )
@@ -585,91 +1662,1256 @@ static bool isStringValid( const char* str, size_t minSize, size_t maxSize )
     return true;
 }
 
-static redisContext* connectToRedis()
+static bool setupGeometry( disruptor* d, int64_t slots, int maxConnections )
 {
-    struct timeval tv;
-    tv.tv_sec = 1;
-    tv.tv_usec = 500000;
-    return redisConnectWithTimeout( "127.0.0.1", 6379, tv );
-}
+    sharedHeader* header = d->header;
 
-static bool mapClient( disruptor* d, unsigned int id )
-{
-    assert( id < MAX_CONNECTIONS );
-    if ( id >= MAX_CONNECTIONS )
-        return false;
+    /* the first participant to get here decides. */
+    cas64( &header->slots, 0, ( slots ? slots : DEFAULT_SLOTS ) );
+    cas64( &header->maxConnections, 0, ( maxConnections ? maxConnections : DEFAULT_CONNECTIONS ) );
+    cas64( &header->producers, 0, ( d->singleProducer ? PRODUCERS_SINGLE : PRODUCERS_MULTI ) );
+    cas64( &header->memory, 0, ( d->hugePages ? MEMORY_HUGE_PAGES : MEMORY_NORMAL ) );
 
-    unmapClient( d, id );
+    /* everyone else must agree, or not care. */
+    d->slotsCount = atomicLoadRelaxed64( &header->slots );
+    d->slotsMask = ( d->slotsCount - 1 );
+    d->maxConnections = (int)atomicLoadRelaxed64( &header->maxConnections );
 
+    if ( slots && slots != d->slotsCount )
     {
-        shmem* s;
-        int64_t size;
-
-        s = shmemOpen( 0, SHMEM_MUST_NOT_CREATE, "disruptor:%s:%d", d->address, id );
-        if ( !s )
-            return false;
-
-        size = shmemGetSize( s );
-        d->buffers[ id ].shmem = s;
-        d->buffers[ id ].start = shmemGetPtr( s );
-        d->buffers[ id ].end = ( d->buffers[ id ].start + size );
-        d->buffers[ id ].tail = d->buffers[ id ].start;
-        handleInfo( d, "for #%d: size=%u", id, (unsigned int)size );
-
-        {
-            redisContext* r = d->redis;
-            redisReply* reply;
-
-            reply = redisCommand( r, "GET disruptor:%s:%d:username", d->address, id );
-            if ( reply->type == REDIS_REPLY_STRING )
-                d->names[ id ] = strclone( reply->str );
-            freeReplyObject( reply );
-        }
-
-        if ( !d->names[ id ] )
-            return false;
+        handleError( d, "ring has %lld slots, not %lld", (long long)d->slotsCount, (long long)slots );
+        return false;
+    }
 
-        return true;
+    if ( maxConnections && maxConnections != d->maxConnections )
+    {
+        handleError( d, "ring allows %d connections, not %d", d->maxConnections, maxConnections );
+        return false;
     }
-}
 
-static void unmapClient( disruptor* d, unsigned int id )
-{
-    assert( id < MAX_CONNECTIONS );
-    if ( id >= MAX_CONNECTIONS )
-        return;
+    if ( d->singleProducer && atomicLoadRelaxed64( &header->producers ) != PRODUCERS_SINGLE )
+    {
+        handleError( d, "ring was created for multiple producers" );
+        return false;
+    }
 
+    if ( d->hugePages && atomicLoadRelaxed64( &header->memory ) != MEMORY_HUGE_PAGES )
     {
-        shmemClose( d->buffers[ id ].shmem );
-        d->buffers[ id ].shmem = NULL;
-        d->buffers[ id ].start = NULL;
-        d->buffers[ id ].tail = NULL;
-        d->buffers[ id ].end = NULL;
+        handleError( d, "ring was created without huge pages" );
+        return false;
     }
 
-    strfree( d->names[ id ] );
-    d->names[ id ] = NULL;
+    d->singleProducer = ( atomicLoadRelaxed64( &header->producers ) == PRODUCERS_SINGLE );
+    d->hugePages = ( atomicLoadRelaxed64( &header->memory ) == MEMORY_HUGE_PAGES );
+    return true;
 }
 
-static bool waitUntilAvailable( disruptor* d, int64_t cursor )
+static bool openRegistry( disruptor* d )
 {
-    int64_t wrapPoint = ( ( cursor + 1 ) - MAX_SLOTS );
-    while ( wrapPoint > getMinimumCursor( d ) )
+    shmem* s;
+    int64_t size;
+
+    /* the header was opened before we knew how many members it must hold,
+     * so map it again at full size. */
+    size = sizeof(sharedHeader) + d->maxConnections * sizeof(sharedMember);
+    s = shmemOpen( size, SHMEM_MUST_NOT_CREATE | d->mapFlags, "disruptor:%s", d->address );
+    if ( !s )
     {
-        atomicYield();
+        handleError( d, "could not open the registry" );
+        return false;
     }
+
+    shmemClose( d->shHeader );
+    d->shHeader = s;
+    d->header = shmemGetPtr( s );
+    d->members = (sharedMember*)( d->header + 1 );
     return true;
 }
 
-static volatile sharedSlot* getSlot( disruptor* d, int64_t cursor )
+static int getSegmentFlags( disruptor* d, bool owned )
 {
-    size_t at = (size_t)(cursor & SLOTS_MASK);
-    return &d->ringbuffer->slots[ at ];
+    int flags = d->mapFlags;
+
+    if ( d->hugePages )
+        flags |= SHMEM_HUGE_PAGES;
+
+    /* only place what we own; our peers decide for their own buffers. */
+    if ( owned && d->numaNode >= 0 )
+        flags |= SHMEM_NODE( d->numaNode );
+
+    return flags;
 }
 
-static int64_t getMinimumCursor( disruptor* d )
+static int findMember( disruptor* d, const char* username )
 {
-    (void)d;
-    return ~(int64_t)0;
+    int64_t i;
+    int64_t count;
+
+    count = atomicLoadRelaxed64( &d->header->connectionsCount );
+    if ( count > d->maxConnections )
+        count = d->maxConnections;
+
+    /* the username is only complete once the member is ready. */
+    for ( i = 0; i < count; ++i )
+    {
+        sharedMember* member = &d->members[ i ];
+        if ( atomicLoadAcquire64( &member->state ) == MEMBER_READY
+                && strcmp( member->username, username ) == 0 )
+            return (int)i;
+    }
+
+    return -1;
 }
 
+#if !DISRUPTOR_USE_REDIS
+static bool registerMember( disruptor* d, bool* wasCreated )
+{
+    int64_t id;
+    sharedMember* member;
+
+    /* try to find an existing mapping. */
+    id = findMember( d, d->username );
+    if ( id >= 0 )
+    {
+        d->id = (int)id;
+        *wasCreated = false;
+        return true;
+    }
+
+    /* if no mapping exists, then assign a new one. */
+    id = ( xadd64( &d->header->connectionsCount, 1 ) - 1 );
+    if ( id >= d->maxConnections )
+    {
+        handleError( d, "too many connections; the address allows %d", d->maxConnections );
+        return false;
+    }
+
+    member = &d->members[ id ];
+    strcpy( member->username, d->username );
+    atomicStoreRelaxed64( &member->state, MEMBER_JOINING );
+
+    d->id = (int)id;
+    *wasCreated = true;
+    return true;
+}
+#endif
+
+#if DISRUPTOR_USE_REDIS
+static bool registerWithRedis( disruptor* d, bool* wasCreated )
+{
+    redisContext* r;
+    redisReply* reply;
+    int id = -1;
+
+    /* connect to redis. */
+    r = d->redis = connectToRedis();
+    if ( !r )
+    {
+        handleError( d, "could not connect to redis" );
+        return false;
+    }
+
+    /* try to fetch an existing mapping. */
+    {
+        reply = redisCommand( r, "GET disruptor:%s:connections:%s:id", d->address, d->username );
+        if ( reply->type == REDIS_REPLY_STRING )
+        {
+            id = atoi( reply->str );
+        }
+        freeReplyObject( reply );
+    }
+
+    *wasCreated = false;
+
+    /* if no mapping exists, then assign a new one. */
+    if ( id < 0 )
+    {
+        {
+            reply = redisCommand( r, "INCR disruptor:%s:connectionsCount", d->address );
+            if ( reply->type == REDIS_REPLY_INTEGER )
+                id = ( reply->integer - 1 );
+            freeReplyObject( reply );
+        }
+
+        assert( id >= 0 );
+        if ( id < 0 )
+        {
+            handleError( d, "could not determine mapping for username '%s'", d->username );
+            return false;
+        }
+
+        *wasCreated = true;
+
+        {
+            reply = redisCommand( r, "SET disruptor:%s:connections:%s:id %d", d->address, d->username, id );
+            freeReplyObject( reply );
+        }
+
+        {
+            reply = redisCommand( r, "SET disruptor:%s:%d:username %s", d->address, id, d->username );
+            freeReplyObject( reply );
+        }
+    }
+
+    if ( id >= d->maxConnections )
+    {
+        handleError( d, "too many connections; the address allows %d", d->maxConnections );
+        return false;
+    }
+
+    /* mirror the mapping into the registry, which is what everyone reads. */
+    if ( *wasCreated )
+    {
+        int64_t count;
+
+        strcpy( d->members[ id ].username, d->username );
+        atomicStoreRelaxed64( &d->members[ id ].state, MEMBER_JOINING );
+
+        count = atomicLoadRelaxed64( &d->header->connectionsCount );
+        while ( count < id + 1 )
+            count = cas64( &d->header->connectionsCount, count, id + 1 );
+    }
+
+    d->id = id;
+    return true;
+}
+
+static redisContext* connectToRedis()
+{
+    struct timeval tv;
+    tv.tv_sec = 1;
+    tv.tv_usec = 500000;
+    return redisConnectWithTimeout( "127.0.0.1", 6379, tv );
+}
+#endif
+
+static void refreshMembers( disruptor* d )
+{
+    int64_t generation;
+    int64_t count;
+    int i;
+
+    /* sample the generation first, so that anyone who becomes ready while
+     * we scan is caught next time. */
+    generation = atomicLoadAcquire64( &d->header->generation );
+
+    count = atomicLoadRelaxed64( &d->header->connectionsCount );
+    if ( count > d->maxConnections )
+        count = d->maxConnections;
+
+    for ( i = 0; i < count; ++i )
+    {
+        if ( d->buffers[ i ].start || atomicLoadRelaxed64( &d->members[ i ].state ) != MEMBER_READY )
+            continue;
+
+        if ( !mapClient( d, i ) )
+            handleError( d, "could not map client %d", i );
+    }
+
+    d->connectionsCount = (int)count;
+    d->generation = generation;
+}
+
+static bool mapSender( disruptor* d, int id )
+{
+    /* a message from someone we haven't mapped yet; they must have joined
+     * since we last looked at the registry. */
+    if ( id < 0 || id >= d->maxConnections )
+        return false;
+
+    refreshMembers( d );
+    return ( d->buffers[ id ].start != NULL );
+}
+
+static bool mapClient( disruptor* d, unsigned int id )
+{
+    assert( id < (unsigned int)d->maxConnections );
+    if ( id >= (unsigned int)d->maxConnections )
+        return false;
+
+    unmapClient( d, id );
+
+    /* the member may have claimed its id but not yet created its send
+     * buffer. */
+    if ( atomicLoadAcquire64( &d->members[ id ].state ) != MEMBER_READY )
+        return false;
+
+    {
+        shmem* s;
+        int64_t size;
+
+        s = shmemOpen( 0, SHMEM_MUST_NOT_CREATE | getSegmentFlags( d, id == (unsigned int)d->id ),
+                "disruptor:%s:%d", d->address, id );
+        if ( !s )
+            return false;
+
+        size = shmemGetSize( s );
+        d->buffers[ id ].shmem = s;
+        d->buffers[ id ].start = shmemGetPtr( s );
+        d->buffers[ id ].end = ( d->buffers[ id ].start + size );
+        d->buffers[ id ].head = d->buffers[ id ].start;
+        d->buffers[ id ].tail = d->buffers[ id ].start;
+        handleDebug( d, "for #%d: size=%u", id, (unsigned int)size );
+
+        d->names[ id ] = strclone( d->members[ id ].username );
+        return true;
+    }
+}
+
+static void unmapClient( disruptor* d, unsigned int id )
+{
+    assert( id < (unsigned int)d->maxConnections );
+    if ( id >= (unsigned int)d->maxConnections )
+        return;
+
+    {
+        shmemClose( d->buffers[ id ].shmem );
+        d->buffers[ id ].shmem = NULL;
+        d->buffers[ id ].start = NULL;
+        d->buffers[ id ].head = NULL;
+        d->buffers[ id ].tail = NULL;
+        d->buffers[ id ].end = NULL;
+    }
+
+    strfree( d->names[ id ] );
+    d->names[ id ] = NULL;
+}
+
+static bool waitUntilAvailable( disruptor* d, int64_t cursor )
+{
+    /* the slot for 'cursor' was last used by the message a full ring
+     * earlier, which every reader must have consumed before we may
+     * overwrite it. */
+    int64_t wrapPoint = ( cursor - d->slotsCount );
+    bool checkReaders = false;
+    waiter w;
+
+    /* only rescan the readers once we catch up to the last known minimum. */
+    if ( wrapPoint <= d->cachedMinimum )
+        return true;
+
+    initWaiter( d, &w, getReaderTimeoutMs( d ) );
+    for ( ;; )
+    {
+        int32_t seen = waiterBegin( &w );
+
+        d->cachedMinimum = getMinimumCursor( d, checkReaders );
+        checkReaders = false;
+        if ( wrapPoint <= d->cachedMinimum )
+            break;
+
+        if ( isStale( d ) )
+        {
+            waiterEnd( &w );
+            handleWarning( d, "dropping message %d; the address was killed or replaced", (int)cursor );
+            return false;
+        }
+
+        countStat( &d->stats[ d->id ].claimWaits, 1 );
+
+        /* a reader which died without detaching would hold us back
+         * forever, so every so often make sure they're all alive. */
+        if ( !waiterIdle( &w, seen ) )
+        {
+            waiterEnd( &w );
+            initWaiter( d, &w, getReaderTimeoutMs( d ) );
+            checkReaders = true;
+        }
+    }
+    waiterEnd( &w );
+
+    return true;
+}
+
+static sharedSlot* getSlot( disruptor* d, int64_t cursor )
+{
+    size_t at = (size_t)(cursor & d->slotsMask);
+    return &d->slots[ at ];
+}
+
+static int64_t getMinimumCursor( disruptor* d, bool dropDead )
+{
+    int i;
+    int count;
+    int64_t result;
+
+    /* our claims must be visible before we look for readers, since an
+     * attaching reader marks itself active before it looks at them. */
+    atomicBarrier();
+
+    /* with no readers, nothing stops us. */
+    result = atomicLoadRelaxed64( &d->ringbuffer->claimCursor.v );
+
+    /* nobody beyond the registry's high-water mark has joined yet, and
+     * anyone who registers after we look starts reading after our claims. */
+    count = (int)atomicLoadRelaxed64( &d->header->connectionsCount );
+    if ( count > d->maxConnections )
+        count = d->maxConnections;
+
+    for ( i = 0; i < count; ++i )
+    {
+        sharedConn* conn = &d->connections[ i ];
+        int64_t reader = atomicLoadRelaxed64( &conn->active );
+        if ( reader )
+        {
+            /* pairs with the reader's release once it's done with a slot. */
+            int64_t readCursor = atomicLoadAcquire64( &conn->readCursor );
+            if ( readCursor >= result )
+                continue;
+
+            /* stop waiting on a reader which died without detaching, unless
+             * someone has just taken over its name. */
+            if ( dropDead && !isProcessAlive( reader ) )
+            {
+                if ( cas64( &conn->active, reader, 0 ) == reader )
+                {
+                    handleWarning( d, "no longer waiting on '%s', which died at %d",
+                            d->members[ i ].username, (int)readCursor );
+                    continue;
+                }
+            }
+
+            result = readCursor;
+        }
+    }
+
+    return result;
+}
+
+static int64_t getReaderTimeoutMs( disruptor* d )
+{
+    /* the same patience we have with a stuck claim. */
+    if ( d->claimTimeoutNs < 0 )
+        return -1;
+    return ( d->claimTimeoutNs / ( 1000 * 1000 ) );
+}
+
+static int64_t getPublishedCursor( disruptor* d, int64_t cursor, int64_t claimCursor )
+{
+    int64_t start = cursor;
+
+    /* find the highest contiguous sequence after 'cursor' which has been
+     * published; claims may be published out of order. */
+    while ( cursor < claimCursor )
+    {
+        int64_t stamp = atomicLoadRelaxed64( &getSlot( d, cursor )->sequence );
+
+        /* a slot which was given up on counts as published; readers skip
+         * it when they get to it. */
+        if ( stamp != ( cursor + 1 ) && stamp != ( ( cursor + 1 ) | STAMP_TOMBSTONE ) )
+        {
+            /* claimed, but its producer hasn't finished publishing it. */
+            countStat( &d->stats[ d->id ].publishStalls, 1 );
+            checkStuckClaim( d, cursor );
+            break;
+        }
+
+        cursor += 1;
+    }
+
+    /* one fence pairs with every stamp we saw, so that the slots and their
+     * payloads are visible. */
+    if ( cursor > start )
+        atomicAcquire();
+    return cursor;
+}
+
+static int64_t getBarrierCursor( disruptor* d, int64_t cursor )
+{
+    int i;
+
+    /* we may only read what every earlier stage is done with.  pairs with
+     * their release once they finish a batch, which also publishes
+     * whatever they changed in place. */
+    for ( i = 0; i < d->barriersCount; ++i )
+    {
+        int64_t readCursor = atomicLoadAcquire64( &d->connections[ d->barriers[ i ] ].readCursor );
+        if ( readCursor < cursor )
+            cursor = readCursor;
+    }
+
+    return cursor;
+}
+
+static int64_t claimSequences( disruptor* d, int n )
+{
+    /* producers race one another for sequences. */
+    if ( !d->singleProducer )
+    {
+        sharedConn* conn = &d->connections[ d->id ];
+        int64_t last = xadd64( &d->ringbuffer->claimCursor.v, n );
+
+        atomicStoreRelaxed64( &conn->claimFirst, last - n + 1 );
+        atomicStoreRelaxed64( &conn->claimLast, last );
+        return last;
+    }
+
+    /* a lone producer just counts. */
+    if ( !d->isProducer && !becomeProducer( d ) )
+        return 0;
+
+    d->claimed += n;
+    return d->claimed;
+}
+
+static void releaseSequences( disruptor* d, int64_t last )
+{
+    /* a lone producer only advances the claim cursor once its slots are
+     * stamped.  nobody else writes it, so a plain store will do. */
+    if ( d->singleProducer )
+        atomicStoreRelease64( &d->ringbuffer->claimCursor.v, last );
+}
+
+static void abandonClaim( disruptor* d, int64_t first, int64_t last )
+{
+    sharedConn* conn = &d->connections[ d->id ];
+
+    /* a lone producer's claims aren't visible until they're released. */
+    if ( d->singleProducer )
+    {
+        d->claimed = ( first - 1 );
+        return;
+    }
+
+    /* readers would wait on the claim until they gave up on it, so give
+     * up on it ourselves.  anything we can't bury yet is disowned, so
+     * that whoever finds it stuck doesn't wait on us. */
+    recoverClaims( d, first, last, false );
+    atomicStoreRelaxed64( &conn->claimFirst, 0 );
+    atomicStoreRelaxed64( &conn->claimLast, 0 );
+}
+
+static bool becomeProducer( disruptor* d )
+{
+    int64_t producer;
+
+    producer = cas64( &d->header->producer, 0, d->id + 1 );
+    if ( producer != 0 && producer != d->id + 1 )
+    {
+        handleError( d, "only '%s' may publish to this address", d->members[ producer - 1 ].username );
+        return false;
+    }
+
+    d->isProducer = true;
+    d->claimed = atomicLoadRelaxed64( &d->ringbuffer->claimCursor.v );
+    return true;
+}
+
+static bool lockClaim( disruptor* d, int64_t first, int n )
+{
+    int64_t* stamp = &getSlot( d, first - 1 )->sequence;
+    int64_t expected = atomicLoadRelaxed64( stamp );
+    int i;
+
+    /* the only other change anyone may make is to give up on the claim. */
+    while ( expected != ( first | STAMP_TOMBSTONE ) )
+    {
+        int64_t prev = cas64( stamp, expected, first | STAMP_WRITING );
+        if ( prev == expected )
+            return true;
+        expected = prev;
+    }
+
+    /* we took so long that someone gave up on us.  the readers would only
+     * wait on the rest of the batch, so give up on that too. */
+    for ( i = 1; i < n; ++i )
+        buryClaim( d, first + i, true );
+
+    handleWarning( d, "gave up publishing %d..%d; it was claimed too long ago",
+            (int)first, (int)( first + n - 1 ) );
+    return false;
+}
+
+static bool buryClaim( disruptor* d, int64_t sequence, bool writerDead )
+{
+    int64_t* stamp = &getSlot( d, sequence - 1 )->sequence;
+    int64_t expected = atomicLoadRelaxed64( stamp );
+
+    for ( ;; )
+    {
+        int64_t prev;
+
+        /* published, given up on, or even reused since. */
+        if ( STAMP_SEQUENCE( expected ) > sequence )
+            return false;
+        if ( expected == sequence || expected == ( sequence | STAMP_TOMBSTONE ) )
+            return false;
+
+        /* a producer is filling it in, which we only interrupt if it's
+         * dead. */
+        if ( expected == ( sequence | STAMP_WRITING ) && !writerDead )
+            return false;
+
+        /* until it's being written, the slot may still hold the message
+         * from a lap earlier, which a slower reader has yet to read.  leave
+         * it until every reader is past that. */
+        if ( expected != ( sequence | STAMP_WRITING )
+                && getMinimumCursor( d, true ) < ( sequence - d->slotsCount ) )
+            return false;
+
+        prev = cas64( stamp, expected, sequence | STAMP_TOMBSTONE );
+        if ( prev == expected )
+            return true;
+        expected = prev;
+    }
+}
+
+static void checkStuckClaim( disruptor* d, int64_t cursor )
+{
+    int64_t now;
+    int64_t sequence = ( cursor + 1 );
+    int64_t last = sequence;
+    bool writerDead = false;
+    int claimant;
+
+    /* a lone producer's claims are only visible once they're published. */
+    if ( d->singleProducer || d->claimTimeoutNs < 0 )
+        return;
+
+    now = clockTicks();
+    if ( cursor != d->stuckCursor )
+    {
+        d->stuckCursor = cursor;
+        d->stuckSince = now;
+        return;
+    }
+
+    if ( clockToNs( &d->header->clock, now ) - clockToNs( &d->header->clock, d->stuckSince ) < d->claimTimeoutNs )
+        return;
+
+    /* don't look again until another timeout has passed. */
+    d->stuckSince = now;
+
+    /* a live producer may just be waiting for a slow reader.  if it died,
+     * give up on everything it had claimed at once.  if nobody admits to
+     * the claim, its producer died before it could say so. */
+    claimant = findClaimant( d, sequence );
+    if ( claimant >= 0 )
+    {
+        if ( isMemberAlive( d, claimant ) )
+            return;
+        writerDead = true;
+        last = atomicLoadRelaxed64( &d->connections[ claimant ].claimLast );
+    }
+
+    if ( recoverClaims( d, sequence, last, writerDead ) )
+    {
+        handleWarning( d, "gave up on %d..%d, claimed by %s", (int)sequence, (int)last,
+                ( claimant >= 0 ? d->members[ claimant ].username : "nobody" ) );
+    }
+}
+
+static int64_t recoverClaims( disruptor* d, int64_t first, int64_t last, bool writerDead )
+{
+    int64_t recovered = 0;
+    int64_t sequence;
+
+    for ( sequence = first; sequence <= last; ++sequence )
+    {
+        if ( buryClaim( d, sequence, writerDead ) )
+            recovered += 1;
+    }
+
+    if ( recovered )
+    {
+        countStat( &d->stats[ d->id ].recovered, recovered );
+        wakeWaiters( d );
+    }
+    return recovered;
+}
+
+static int findClaimant( disruptor* d, int64_t sequence )
+{
+    int64_t count;
+    int i;
+
+    count = atomicLoadRelaxed64( &d->header->connectionsCount );
+    if ( count > d->maxConnections )
+        count = d->maxConnections;
+
+    /* an old claim can't cover a sequence which is still unpublished, so
+     * at most one connection's can. */
+    for ( i = 0; i < count; ++i )
+    {
+        sharedConn* conn = &d->connections[ i ];
+        if ( atomicLoadRelaxed64( &conn->claimFirst ) <= sequence
+                && sequence <= atomicLoadRelaxed64( &conn->claimLast ) )
+            return i;
+    }
+
+    return -1;
+}
+
+static bool isMemberAlive( disruptor* d, int id )
+{
+    int64_t pid = atomicLoadRelaxed64( &d->members[ id ].pid );
+
+    if ( pid <= 0 )
+        return true;
+    return isProcessAlive( pid );
+}
+
+static bool isTombstone( disruptor* d, disruptorMsg m )
+{
+    return ( atomicLoadRelaxed64( &getSlot( d, m - 1 )->sequence ) & STAMP_TOMBSTONE ) != 0;
+}
+
+#if DISRUPTOR_ORDERED_PUBLISH
+static void waitForEarlierClaims( disruptor* d, int64_t first )
+{
+    int64_t previous = ( first - 1 );
+    int64_t* stamp;
+    waiter w;
+
+    /* a lone producer publishes in order anyway. */
+    if ( d->singleProducer || previous <= 0 )
+        return;
+
+    /* the earlier claim is done once its slot is stamped, given up on, or
+     * even reused since. */
+    stamp = &getSlot( d, previous - 1 )->sequence;
+    initWaiter( d, &w, -1 );
+    for ( ;; )
+    {
+        int32_t seen = waiterBegin( &w );
+        int64_t s = atomicLoadRelaxed64( stamp );
+
+        if ( s == previous || s == ( previous | STAMP_TOMBSTONE ) || STAMP_SEQUENCE( s ) > previous )
+            break;
+        if ( isStale( d ) )
+            break;
+
+        waiterIdle( &w, seen );
+    }
+    waiterEnd( &w );
+}
+#endif
+
+static bool publishSlot( disruptor* d, const char* data, int64_t size, bool isInline )
+{
+    sharedStats* s = &d->stats[ d->id ];
+    int64_t claim;
+    int64_t timestamp;
+
+    /* increment the claim cursor. */
+    claim = claimSequences( d, 1 );
+    if ( !claim )
+    {
+        if ( !isInline )
+            d->buffers[ d->id ].tail = (char*)data;
+        return false;
+    }
+
+    /* block until the slot is ready. */
+    if ( !waitUntilAvailable( d, claim ) )
+    {
+        abandonClaim( d, claim, claim );
+        if ( !isInline )
+            d->buffers[ d->id ].tail = (char*)data;
+        return false;
+    }
+
+    if ( !d->singleProducer && !lockClaim( d, claim, 1 ) )
+    {
+        if ( !isInline )
+            d->buffers[ d->id ].tail = (char*)data;
+        return false;
+    }
+
+    timestamp = clockTicks();
+    fillSlot( d, claim, data, size, isInline, timestamp );
+
+    /* remember the payload until every reader is past this slot. */
+    if ( !isInline && size > 0 )
+        recordPayload( d, claim );
+
+#if DISRUPTOR_ORDERED_PUBLISH
+    waitForEarlierClaims( d, claim );
+#endif
+
+    /* publish the slot.  producers never wait on one another; readers
+     * stop at the first slot which hasn't been published yet. */
+    atomicStoreRelease64( &getSlot( d, claim - 1 )->sequence, claim );
+    releaseSequences( d, claim );
+
+    wakeWaiters( d );
+
+    countStat( &s->published, 1 );
+    countStat( &s->publishedBytes, size );
+    atomicStoreRelaxed64( &s->lastActive, timestamp );
+
+    handleTrace( d, "publish %d", (int)claim );
+
+    return true;
+}
+
+static void fillSlot( disruptor* d, int64_t claim, const char* data, int64_t size, bool isInline,
+        int64_t timestamp )
+{
+    sendBuffer* buf = &d->buffers[ d->id ];
+    sharedSlot* slot;
+
+    slot = getSlot( d, claim - 1 );
+    slot->sender = d->id;
+    slot->size = size;
+    slot->timestamp = timestamp;
+
+    if ( isInline )
+    {
+        slot->flags = SLOT_INLINE;
+        memcpy( (char*)slot->payload.data, data, size );
+    }
+    else
+    {
+        slot->flags = 0;
+        slot->payload.offset = (data - buf->start);
+    }
+}
+
+static void recordPayload( disruptor* d, int64_t claim )
+{
+    sendBuffer* buf = &d->buffers[ d->id ];
+
+    reclaimPayloads( d );
+    assert( d->pendingLast - d->pendingFirst < d->slotsCount );
+    d->pending[ d->pendingLast & d->slotsMask ].sequence = claim;
+    d->pending[ d->pendingLast & d->slotsMask ].end = buf->tail;
+    d->pendingLast += 1;
+}
+
+static char* claimPayload( disruptor* d, size_t size )
+{
+    char* result;
+    sendBuffer* buf;
+    bool checkReaders = false;
+    waiter w;
+
+    buf = &d->buffers[ d->id ];
+
+    /* too big to ever fit? */
+    if ( (int64_t)size > ( buf->end - buf->start ) )
+        return NULL;
+
+    /* usually there's room without having to look at the readers. */
+    reclaimPayloads( d );
+    result = allocPayload( d, size );
+    if ( result )
+        return result;
+
+    /* otherwise wait for the readers to release some of our payloads. */
+    countStat( &d->stats[ d->id ].bufferFulls, 1 );
+    initWaiter( d, &w, getReaderTimeoutMs( d ) );
+    for ( ;; )
+    {
+        int32_t seen = waiterBegin( &w );
+
+        d->cachedMinimum = getMinimumCursor( d, checkReaders );
+        checkReaders = false;
+        reclaimPayloads( d );
+        result = allocPayload( d, size );
+        if ( result )
+            break;
+
+        /* the readers we're waiting on may have moved to a new address. */
+        if ( isStale( d ) )
+        {
+            waiterEnd( &w );
+            if ( !reattach( d ) )
+                return NULL;
+            return claimPayload( d, size );
+        }
+
+        /* one of them may have died; look again once in a while. */
+        if ( !waiterIdle( &w, seen ) )
+        {
+            waiterEnd( &w );
+            initWaiter( d, &w, getReaderTimeoutMs( d ) );
+            checkReaders = true;
+        }
+    }
+    waiterEnd( &w );
+
+    return result;
+}
+
+static bool isSizeValid( disruptor* d, size_t size )
+{
+    /* a slot only has room for a 32-bit size. */
+    if ( size > INT32_MAX )
+    {
+        handleError( d, "messages must be at most %d bytes, not %llu", INT32_MAX, (unsigned long long)size );
+        return false;
+    }
+    return true;
+}
+
+static char* allocPayload( disruptor* d, size_t size )
+{
+    sendBuffer* buf = &d->buffers[ d->id ];
+    char* result;
+
+    /* nothing outstanding; start over from the beginning. */
+    if ( d->pendingFirst == d->pendingLast )
+        buf->head = buf->tail = buf->start;
+
+    /* payloads are never split across the end, so if there's no room
+     * after the tail, the remainder is skipped and we wrap to the start. */
+    result = buf->tail;
+    if ( buf->tail > buf->head || d->pendingFirst == d->pendingLast )
+    {
+        if ( result + size > buf->end )
+        {
+            result = buf->start;
+            if ( result + size > buf->head )
+                return NULL;
+        }
+    }
+    else
+    {
+        if ( result + size > buf->head )
+            return NULL;
+    }
+
+    buf->tail = ( result + size );
+    saveSendBuffer( d );
+    return result;
+}
+
+static void reclaimPayloads( disruptor* d )
+{
+    sendBuffer* buf = &d->buffers[ d->id ];
+    int64_t first = d->pendingFirst;
+
+    /* everything at or below the slowest reader has been seen by all. */
+    while ( d->pendingFirst < d->pendingLast )
+    {
+        pendingPayload* p = &d->pending[ d->pendingFirst & d->slotsMask ];
+        if ( p->sequence > d->cachedMinimum )
+            break;
+
+        buf->head = p->end;
+        d->pendingFirst += 1;
+    }
+
+    if ( d->pendingFirst != first )
+        saveSendBuffer( d );
+}
+
+static void initWaiter( disruptor* d, waiter* w, int64_t timeoutMs )
+{
+    waiterInit( w, d->waitStrategy, timeoutMs, &d->header->signal, &d->header->waiters );
+}
+
+static void wakeWaiters( disruptor* d )
+{
+    /* nobody ever blocks on most rings, so keep this to a single load. */
+    if ( !atomicLoadRelaxed64( &d->header->blockers ) )
+        return;
+
+    /* make our progress visible before we look for sleepers; they make
+     * themselves visible before they look for progress. */
+    atomicBarrier();
+    waiterWakeAll( &d->header->signal, &d->header->waiters );
+}
+
+static bool swapBlocker( disruptor* d, int id, int64_t from, int64_t to )
+{
+    /* whoever sets or clears a connection's blocker keeps the count, so
+     * each is counted once, however many notice that its process died. */
+    if ( cas64( &d->connections[ id ].blocker, from, to ) != from )
+        return false;
+    if ( !from != !to )
+        xadd64( &d->header->blockers, ( to ? 1 : -1 ) );
+    return true;
+}
+
+static void setBlocker( disruptor* d, int64_t pid )
+{
+    int64_t blocker;
+
+    do
+        blocker = atomicLoadRelaxed64( &d->connections[ d->id ].blocker );
+    while ( !swapBlocker( d, d->id, blocker, pid ) );
+}
+
+static void reapBlockers( disruptor* d )
+{
+    int count;
+    int i;
+
+    if ( !d->connections || !atomicLoadRelaxed64( &d->header->blockers ) )
+        return;
+
+    count = (int)atomicLoadRelaxed64( &d->header->connectionsCount );
+    for ( i = 0; i < count && i < d->maxConnections; ++i )
+    {
+        int64_t blocker = atomicLoadRelaxed64( &d->connections[ i ].blocker );
+        if ( blocker && !isProcessAlive( blocker ) && swapBlocker( d, i, blocker, 0 ) )
+            handleDebug( d, "'%s' died while blocking", d->members[ i ].username );
+    }
+}
+
+static void attachReader( disruptor* d, bool wasCreated )
+{
+    sharedConn* conn = &d->connections[ d->id ];
+    int64_t claimCursor;
+    int64_t reader;
+    int64_t prev;
+
+    /* a new connection only sees what is published after it joins. */
+    if ( wasCreated )
+        atomicStoreRelaxed64( &conn->readCursor, atomicLoadRelaxed64( &d->ringbuffer->claimCursor.v ) );
+
+    /* start gating the producers, taking over from our predecessor if it
+     * died while reading; producers only stop waiting on a dead reader if
+     * it's still the one there.  this must be visible before we look at
+     * the claim cursor; producers do the opposite. */
+    reader = atomicLoadRelaxed64( &conn->active );
+    while ( ( prev = cas64( &conn->active, reader, getpid() ) ) != reader )
+        reader = prev;
+    atomicBarrier();
+    claimCursor = atomicLoadRelaxed64( &d->ringbuffer->claimCursor.v );
+
+    if ( wasCreated )
+    {
+        releaseReadCursor( d, claimCursor );
+        return;
+    }
+
+    /* if our predecessor was still gating the producers, everything after
+     * its read cursor is as it left it. */
+    if ( reader )
+        return;
+
+    /* otherwise nobody waited on us while we were detached.  the producers
+     * may have lapped us, or given back the send buffer space of messages
+     * which every other reader was done with; either way, skip to where
+     * the rest of the readers are. */
+    {
+        int64_t readCursor = atomicLoadRelaxed64( &conn->readCursor );
+        int64_t safeCursor = claimCursor;
+        bool lost = ( claimCursor - readCursor > d->slotsCount );
+        int64_t sequence;
+        int count = (int)atomicLoadRelaxed64( &d->header->connectionsCount );
+        int i;
+
+        for ( i = 0; i < count && i < d->maxConnections; ++i )
+        {
+            sharedConn* other = &d->connections[ i ];
+            if ( i != d->id && atomicLoadRelaxed64( &other->active ) )
+            {
+                int64_t otherCursor = atomicLoadAcquire64( &other->readCursor );
+                if ( otherCursor < safeCursor )
+                    safeCursor = otherCursor;
+            }
+        }
+
+        /* anything inline is still in the ring. */
+        for ( sequence = readCursor; !lost && sequence < safeCursor; ++sequence )
+        {
+            if ( !( getSlot( d, sequence )->flags & SLOT_INLINE ) )
+                lost = true;
+        }
+
+        if ( lost && readCursor < safeCursor )
+        {
+            handleWarning( d, "skipping %d unread messages", (int)( safeCursor - readCursor ) );
+            releaseReadCursor( d, safeCursor );
+        }
+    }
+}
+
+static bool startReading( disruptor* d )
+{
+    sharedConn* conn = &d->connections[ d->id ];
+    int64_t claimCursor;
+    int64_t workCursor;
+
+    if ( d->writeOnly )
+    {
+        handleError( d, "can't receive on a write-only connection" );
+        return false;
+    }
+    d->reading = true;
+
+    /* we've been gating the producers since we joined, so everything after
+     * our read cursor is still there. */
+    if ( !d->group )
+        return true;
+
+    /* a worker picks up wherever its group has got to.  until it claims
+     * something, it holds the producers back on the group's behalf. */
+    claimCursor = atomicLoadRelaxed64( &d->ringbuffer->claimCursor.v );
+    workCursor = atomicLoadRelaxed64( &d->group->workCursor );
+    if ( workCursor < ( claimCursor - d->slotsCount ) )
+    {
+        handleWarning( d, "group skipping %d unread messages", (int)( claimCursor - workCursor ) );
+        cas64( &d->group->workCursor, workCursor, claimCursor );
+        workCursor = atomicLoadRelaxed64( &d->group->workCursor );
+    }
+    atomicStoreRelaxed64( &conn->readCursor, workCursor );
+    return true;
+}
+
+static void detachReader( disruptor* d )
+{
+    sharedConn* conn = &d->connections[ d->id ];
+
+    /* release whatever we've handed out, and stop gating the producers. */
+    releaseReadCursor( d, d->readStart );
+    atomicStoreRelease64( &conn->active, 0 );
+
+    d->readStart = d->readEnd = 0;
+    wakeWaiters( d );
+}
+
+static void fillEvent( disruptor* d, disruptorEvent* e, disruptorMsg m )
+{
+    sharedSlot* slot = getSlot( d, m - 1 );
+    int sender = (int)slot->sender;
+
+    /* the same lookups as the msgGet*() accessors, done once per slot. */
+    if ( !d->names[ sender ] )
+        mapSender( d, sender );
+
+    e->msg = m;
+    e->sequence = ( m - 1 );
+    e->timestampNs = clockToNs( &d->header->clock, slot->timestamp );
+    e->size = slot->size;
+    e->senderId = sender;
+    e->sender = d->names[ sender ];
+
+    if ( slot->flags & SLOT_INLINE )
+        e->data = (char*)slot->payload.data;
+    else if ( d->buffers[ sender ].start )
+        e->data = &d->buffers[ sender ].start[ slot->payload.offset ];
+    else
+        e->data = NULL;
+}
+
+static void countStat( int64_t* stat, int64_t n )
+{
+    /* only the connection itself writes its stats, so a plain increment
+     * will do; monitors may see it a little late. */
+    atomicStoreRelaxed64( stat, atomicLoadRelaxed64( stat ) + n );
+}
+
+static bool openGroups( disruptor* d )
+{
+    int64_t size = shmapGetMemSize( sizeof(sharedGroup), d->maxConnections );
+
+    d->shGroups = shmemOpen( size, SHMEM_DEFAULT | d->mapFlags, "disruptor:%s:groups", d->address );
+    if ( !d->shGroups )
+    {
+        handleError( d, "could not open the groups" );
+        return false;
+    }
+
+    d->groups = shmapCreate( shmemGetPtr( d->shGroups ), shmemGetSize( d->shGroups ),
+            sizeof(sharedGroup), "disruptor:%s:groups", d->address );
+    return ( d->groups != NULL );
+}
+
+static bool fetchBatch( disruptor* d )
+{
+    /* workers share the messages rather than each seeing all of them. */
+    if ( d->group )
+    {
+        if ( !claimFromGroup( d ) )
+            return false;
+    }
+    else
+    {
+        if ( !fetchFromRing( d ) )
+            return false;
+    }
+
+    /* anyone who published in this batch became ready before doing so, so
+     * one check here covers every message in it. */
+    if ( atomicLoadRelaxed64( &d->header->generation ) != d->generation )
+        refreshMembers( d );
+
+    countStat( &d->stats[ d->id ].consumed, d->readEnd - d->readStart );
+    atomicStoreRelaxed64( &d->stats[ d->id ].lastActive, clockTicks() );
+    return true;
+}
+
+static bool fetchFromRing( disruptor* d )
+{
+    int64_t readCursor;
+    int64_t limit;
+    int64_t publishCursor;
+
+    /* the last batch has been consumed, so release its slots to the
+     * producers. */
+    releaseReadCursor( d, d->readEnd );
+
+    readCursor = atomicLoadRelaxed64( &d->connections[ d->id ].readCursor );
+    limit = atomicLoadRelaxed64( &d->ringbuffer->claimCursor.v );
+    if ( d->barriersCount )
+        limit = getBarrierCursor( d, limit );
+
+    publishCursor = getPublishedCursor( d, readCursor, limit );
+    if ( readCursor >= publishCursor )
+        return false;
+
+    d->readStart = readCursor;
+    d->readEnd = publishCursor;
+    return true;
+}
+
+static bool claimFromGroup( disruptor* d )
+{
+    sharedGroup* g = d->group;
+    int64_t workCursor = atomicLoadRelaxed64( &g->workCursor );
+    int64_t n;
+
+    for ( ;; )
+    {
+        int64_t limit = atomicLoadRelaxed64( &d->ringbuffer->claimCursor.v );
+        int64_t publishCursor;
+        int64_t prev;
+
+        if ( d->barriersCount )
+            limit = getBarrierCursor( d, limit );
+
+        /* only claim what's already published, so that we never sit on a
+         * claim while the rest of the group has work to do. */
+        publishCursor = getPublishedCursor( d, workCursor, limit );
+        if ( publishCursor <= workCursor )
+        {
+            /* everything up to the work cursor belongs to someone else,
+             * who holds the producers back for themselves. */
+            releaseReadCursor( d, workCursor );
+            return false;
+        }
+
+        n = ( publishCursor - workCursor );
+        if ( n > d->groupBatch )
+            n = d->groupBatch;
+
+        prev = cas64( &g->workCursor, workCursor, workCursor + n );
+        if ( prev == workCursor )
+            break;
+        workCursor = prev;
+    }
+
+    /* we're done with everything before our claim. */
+    releaseReadCursor( d, workCursor );
+
+    d->readStart = workCursor;
+    d->readEnd = workCursor + n;
+    return true;
+}
+
+static void releaseReadCursor( disruptor* d, int64_t cursor )
+{
+    sharedConn* conn = &d->connections[ d->id ];
+
+    /* the release keeps our reads of the slots from moving past it. */
+    if ( cursor > atomicLoadRelaxed64( &conn->readCursor ) )
+    {
+        atomicStoreRelease64( &conn->readCursor, cursor );
+        wakeWaiters( d );
+    }
+}
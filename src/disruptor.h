@@ -21,14 +21,131 @@ typedef struct disruptor disruptor;
 
 typedef int64_t disruptorMsg;
 
+struct disruptorMonitor;
+typedef struct disruptorMonitor disruptorMonitor;
+
+#define DISRUPTOR_MAX_USERNAME_LENGTH   31
+
+/* wait strategies. */
+#define DISRUPTOR_WAIT_YIELD        0
+#define DISRUPTOR_WAIT_SPIN         1
+#define DISRUPTOR_WAIT_BACKOFF      2
+#define DISRUPTOR_WAIT_BLOCK        3
+
+/* options for disruptorCreate(); zero-initialize for the defaults. */
+typedef struct disruptorOptions
+{
+    /* how this participant waits for free slots and new messages. */
+    int waitStrategy;
+
+    /* copy small payloads into the ring itself, so that readers touch a
+     * single cache line per message. */
+    bool inlinePayloads;
+
+    /* the geometry of the ring, fixed by whoever creates the address.
+     * joiners may leave these zero to accept whatever it was created with;
+     * otherwise they must match.  slots must be a power of two. */
+    int64_t slots;
+    int maxConnections;
+
+    /* declare that only one participant will ever publish, which lets it
+     * claim slots without any atomic read-modify-write.  like the geometry,
+     * this is fixed by whoever creates the address; the first participant
+     * to publish becomes the producer, and anyone else who tries fails. */
+    bool singleProducer;
+
+    /* every participant holds the producers back from the moment it joins
+     * until it's released, so that it misses nothing published in between.
+     * one which will only ever publish should set this, so that it doesn't;
+     * it can't receive. */
+    bool writeOnly;
+
+    /* back the ring and the send buffers with huge pages from a hugetlbfs
+     * mount; see shmem.h.  this too is fixed by whoever creates the
+     * address, and joiners who leave it unset follow along. */
+    bool hugePages;
+
+    /* fault in every page we map up front, and optionally lock them in,
+     * so that the hot path never takes a page fault. */
+    bool prefault;
+    bool lockMemory;
+
+    /* place the ring and our send buffer on NUMA node 'numaNode'. */
+    bool bindNode;
+    int numaNode;
+
+    /* how long a message may sit claimed but unpublished before we give
+     * up on it, if the participant which claimed it has died or can't be
+     * identified.  readers skip messages which were given up.  producers
+     * likewise stop waiting on a reader which has been holding them back
+     * this long, if it has died.  zero for the default of a second, or
+     * negative to wait forever. */
+    int64_t claimTimeoutMs;
+} disruptorOptions;
+
+/* one connection's counters, as read by disruptorMonitorGetStats().  each
+ * connection keeps its own in shared memory as it goes. */
+typedef struct disruptorStats
+{
+    int id;
+    char username[ DISRUPTOR_MAX_USERNAME_LENGTH + 1 ];
+
+    /* whether the connection is reading, and if so, how many published
+     * messages it has yet to consume. */
+    bool reading;
+    int64_t lag;
+
+    int64_t published;
+    int64_t publishedBytes;
+    int64_t consumed;
+
+    /* how many times this connection waited for readers to free a slot,
+     * found the next slot claimed but not yet published, or found its send
+     * buffer full. */
+    int64_t claimWaits;
+    int64_t publishStalls;
+    int64_t bufferFulls;
+
+    /* how many stuck claims this connection gave up on, and its process. */
+    int64_t recovered;
+    int64_t pid;
+
+    /* when it last published or fetched messages, in nanoseconds since
+     * the epoch, or zero if it never has. */
+    int64_t lastActiveNs;
+} disruptorStats;
+
+/* a received message, with everything a handler usually wants already
+ * looked up.  'data' is NULL if the sender couldn't be mapped, and like
+ * msgGetData() it's only valid until the handler returns. */
+typedef struct disruptorEvent
+{
+    disruptorMsg msg;
+    int64_t sequence;
+    int64_t timestampNs;
+    char* data;
+    size_t size;
+    int senderId;
+    const char* sender;
+} disruptorEvent;
+
+/* called with 'count' consecutive events.  'endOfBatch' is set on the last
+ * call for a batch, when the handler should flush anything it's buffering;
+ * there may be nothing more to process for a while.  if the rest of a batch
+ * was given up, that last call may have no events. */
+typedef void (*disruptorHandler)( void* ctx, const disruptorEvent* events, int count, bool endOfBatch );
+
 /*-----------------------------------------------------------------------------
 * Function prototypes
 *----------------------------------------------------------------------------*/
 
 void disruptorKill( const char* address );
-disruptor* disruptorCreate( const char* address, const char* username, int64_t sendBufferSize );
+disruptor* disruptorCreate( const char* address, const char* username, int64_t sendBufferSize,
+        const disruptorOptions* options );
 void disruptorRelease( disruptor* d );
 
+/* a message may be at most INT32_MAX bytes, and no bigger than the send
+ * buffer unless it's inline. */
 bool disruptorSend( disruptor* d, const char* msg, size_t size );
 bool disruptorPrintf( disruptor* d, const char* format, ... );
 bool disruptorVPrintf( disruptor* d, const char* format, va_list ap );
@@ -36,13 +153,63 @@ bool disruptorVPrintf( disruptor* d, const char* format, va_list ap );
 char* disruptorClaim( disruptor* d, size_t size );
 bool disruptorPublish( disruptor* d, char* ptr );
 
+/* claim space for n messages at once, returning a pointer to each.  the
+ * pointers are valid until disruptorPublishBatch(), which publishes them
+ * with a single atomic increment; readers see all of them or none. */
+char** disruptorClaimBatch( disruptor* d, int n, const size_t sizes[] );
+bool disruptorPublishBatch( disruptor* d );
+
 disruptorMsg disruptorRecv( disruptor* d );
+disruptorMsg disruptorRecvWait( disruptor* d, int64_t timeoutMs );
+
+/* receive everything available and pass it to 'handler', at most
+ * 'maxBatch' events per call, returning how many were processed.  the
+ * slots are released once the whole batch is handled, rather than as each
+ * message is received, so the producers and later stages see one update
+ * per batch.  this may be mixed with disruptorRecv(). */
+int64_t disruptorProcess( disruptor* d, disruptorHandler handler, void* ctx, int maxBatch );
+int64_t disruptorProcessWait( disruptor* d, disruptorHandler handler, void* ctx, int maxBatch,
+        int64_t timeoutMs );
+
+/* make this connection a later stage of a pipeline: it only receives each
+ * message once the connection named 'username' has consumed it, and sees
+ * anything that stage changed in the message's data, without a copy.  call
+ * it before receiving, once per earlier stage.  the earlier stage must
+ * already have joined, and stages must not follow one another in a cycle.
+ * producers need only wait for the last stages, which they do anyway. */
+bool disruptorFollow( disruptor* d, const char* username );
+
+/* share messages with the other members of 'group' instead of receiving
+ * every one: each message is received by exactly one member.  members
+ * claim up to 'batch' messages at a time, and only ones which have already
+ * been published, so a slow member only holds up the others once the ring
+ * wraps around to what it has claimed.  messages claimed but not received
+ * when a member is released are lost.  call it before receiving. */
+bool disruptorJoinGroup( disruptor* d, const char* group, int batch );
 char* msgGetData( disruptor* d, disruptorMsg m );
 size_t msgGetSize( disruptor* d, disruptorMsg m );
 int64_t msgGetSequence( disruptor* d, disruptorMsg m );
 int64_t msgGetTimestamp( disruptor* d, disruptorMsg m );
+
+/* the timestamp in nanoseconds since the epoch.  every process on the
+ * machine shares one calibration, so these are comparable with each other
+ * and with disruptorGetTimeNs(). */
+int64_t msgGetTimestampNs( disruptor* d, disruptorMsg m );
+int64_t disruptorGetTimeNs( disruptor* d );
 const char* msgGetSender( disruptor* d, disruptorMsg m );
 int msgGetSenderId( disruptor* d, disruptorMsg m );
 
+/* map an address read-only, without joining it, to watch its connections.
+ * nothing the monitor does is visible to the participants. */
+disruptorMonitor* disruptorMonitorOpen( const char* address );
+void disruptorMonitorRelease( disruptorMonitor* m );
+
+/* fills in up to maxStats entries, one per connection which has joined,
+ * and returns how many were filled in. */
+int disruptorMonitorGetStats( disruptorMonitor* m, disruptorStats stats[], int maxStats );
+int64_t disruptorMonitorGetCursor( disruptorMonitor* m );
+int64_t disruptorMonitorGetSlots( disruptorMonitor* m );
+int64_t disruptorMonitorGetTimeNs( disruptorMonitor* m );
+
 #endif
 
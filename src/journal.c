@@ -0,0 +1,859 @@
+#define _GNU_SOURCE
+#include "journal.h"
+
+#include "util.h"
+#include "zmalloc.h"
+#include "logger.h"
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* constants. */
+#define SEGMENT_MAGIC           "DJOURNAL"
+#define SEGMENT_VERSION         1
+#define SEGMENT_NAME_FORMAT     "%s/%08lld.journal"
+#define RECORD_ALIGNMENT        8
+#define CRC32C_POLYNOMIAL       0x82f63b78
+
+/* at the start of every segment file. */
+typedef struct segmentHeader
+{
+    char magic[ 8 ];
+    int64_t version;
+    int64_t index;
+    int64_t segmentSize;
+    int64_t padding[4];
+} segmentHeader;
+
+/* precedes each record's sender and payload.  records start on
+ * RECORD_ALIGNMENT boundaries, and the rest of a segment is zero, so a
+ * zero length marks the end of the records. */
+typedef struct recordHeader
+{
+    /* crc32c of the rest of the record, from 'length' to the end of the
+     * payload. */
+    uint32_t crc;
+    uint32_t length;
+    int64_t sequence;
+    int64_t timestampNs;
+    uint32_t size;
+    int16_t senderId;
+
+    /* the sender's name follows, including its terminator, and then the
+     * payload. */
+    uint16_t senderLength;
+} recordHeader;
+
+struct journal
+{
+    char* dir;
+    journalOptions options;
+
+    /* the segment being appended to. */
+    int64_t index;
+    int fd;
+    char* map;
+    int64_t mapSize;
+    int64_t tail;
+
+    /* how far writeback has been started, how far it's known to have
+     * finished, and when the last sync finished. */
+    int64_t flushed;
+    int64_t synced;
+    int64_t syncedNs;
+
+    int64_t lastSequence;
+
+    /* whether anything failed during journalRecord(). */
+    bool failed;
+};
+
+/* what journalReplayInto() publishes through. */
+typedef struct replayTarget
+{
+    disruptor* d;
+    size_t* sizes;
+    bool failed;
+} replayTarget;
+
+/* logging; see logger.h. */
+#define handleError( dir, ... )     loggerReport( report, dir, LOGGER_ERROR, __VA_ARGS__ )
+#define handleWarning( dir, ... )   loggerReport( report, dir, LOGGER_WARNING, __VA_ARGS__ )
+#define handleDebug( dir, ... )     loggerReport( report, dir, LOGGER_DEBUG, __VA_ARGS__ )
+
+/* crc32c, with the lookup tables for when there's no crc32 instruction. */
+static uint32_t crcTable[ 8 ][ 256 ];
+static bool crcHardware;
+static bool crcReady;
+
+/* forward declarations. */
+static bool startup( journal* j );
+static void shutdown( journal* j );
+static void report( const char* dir, int level, const char* fmt, ... );
+static int findSegments( const char* dir, int64_t* first, int64_t* last );
+static bool createSegment( journal* j );
+static bool openSegment( journal* j );
+static void closeSegment( journal* j );
+static bool syncRange( journal* j, int flags );
+static bool syncDirectory( const char* dir );
+static bool isUnwritten( int fd, off_t size );
+static const recordHeader* getRecord( const char* map, int64_t size, int64_t offset );
+static int64_t replaySegment( const char* dir, int64_t index, int64_t fromSequence,
+        disruptorHandler handler, void* ctx, disruptorEvent* events, int maxBatch );
+static void appendEvents( void* ctx, const disruptorEvent* events, int count, bool endOfBatch );
+static void publishEvents( void* ctx, const disruptorEvent* events, int count, bool endOfBatch );
+static int64_t alignRecord( int64_t length );
+static int64_t getNs();
+static void initCrc();
+static uint32_t crc32c( const void* data, size_t size );
+
+/*-----------------------------------------------------------------------------
+* Public API definitions.
+*----------------------------------------------------------------------------*/
+
+journal* journalOpen( const char* dir, const journalOptions* options )
+{
+    journal* j = zcalloc( sizeof( journal ) );
+    j->dir = strclone( dir );
+    j->fd = -1;
+    j->lastSequence = -1;
+    if ( options )
+        j->options = *options;
+    if ( !startup( j ) )
+    {
+        journalRelease( j );
+        return NULL;
+    }
+    return j;
+}
+
+void journalRelease( journal* j )
+{
+    if ( !j )
+        return;
+
+    shutdown( j );
+    strfree( j->dir );
+    zfree( j );
+}
+
+bool journalAppend( journal* j, const disruptorEvent* e )
+{
+    size_t senderLength = ( e->sender ? strlen( e->sender ) : 0 ) + 1;
+    int64_t length = ( sizeof(recordHeader) + senderLength + e->size );
+    int64_t padded = alignRecord( length );
+    recordHeader* r;
+    char* p;
+
+    /* the reader couldn't map the sender, so there's nothing to keep. */
+    if ( e->size && !e->data )
+    {
+        handleError( j->dir, "the payload of message %lld from '%s' isn't mapped",
+                (long long)e->sequence, ( e->sender ? e->sender : "?" ) );
+        return false;
+    }
+
+    /* too big to ever fit? */
+    if ( padded > j->options.segmentSize - (int64_t)sizeof(segmentHeader) || senderLength > UINT16_MAX )
+    {
+        handleError( j->dir, "a record of %lld bytes doesn't fit in a segment of %lld",
+                (long long)length, (long long)j->options.segmentSize );
+        return false;
+    }
+
+    /* move on to the next segment once this one's full. */
+    if ( j->map && j->tail + padded > j->mapSize )
+    {
+        closeSegment( j );
+        j->index += 1;
+    }
+    if ( !j->map && !createSegment( j ) )
+        return false;
+
+    r = (recordHeader*)( j->map + j->tail );
+    r->length = (uint32_t)length;
+    r->sequence = e->sequence;
+    r->timestampNs = e->timestampNs;
+    r->size = (uint32_t)e->size;
+    r->senderId = (int16_t)e->senderId;
+    r->senderLength = (uint16_t)senderLength;
+
+    p = (char*)( r + 1 );
+    memcpy( p, ( e->sender ? e->sender : "" ), senderLength );
+    if ( e->size )
+        memcpy( p + senderLength, e->data, e->size );
+
+    r->crc = crc32c( &r->length, length - sizeof(r->crc) );
+
+    j->tail += padded;
+    j->lastSequence = e->sequence;
+    return true;
+}
+
+bool journalFlush( journal* j )
+{
+    switch ( j->options.syncPolicy )
+    {
+    case JOURNAL_SYNC_ASYNC:
+        return syncRange( j, MS_ASYNC );
+
+    case JOURNAL_SYNC_BATCH:
+        return syncRange( j, MS_SYNC );
+
+    case JOURNAL_SYNC_INTERVAL:
+        if ( getNs() - j->syncedNs < j->options.syncIntervalMs * 1000 * 1000 )
+            return true;
+        return syncRange( j, MS_SYNC );
+
+    default:
+        return true;
+    }
+}
+
+bool journalSync( journal* j )
+{
+    return syncRange( j, MS_SYNC );
+}
+
+int64_t journalGetLastSequence( journal* j )
+{
+    return j->lastSequence;
+}
+
+int64_t journalRecord( journal* j, disruptor* d, int maxBatch, int64_t timeoutMs )
+{
+    int64_t appended;
+
+    j->failed = false;
+    appended = disruptorProcessWait( d, appendEvents, j, maxBatch, timeoutMs );
+    return ( j->failed ? -1 : appended );
+}
+
+int64_t journalReplay( const char* dir, int64_t fromSequence, disruptorHandler handler, void* ctx,
+        int maxBatch )
+{
+    disruptorEvent* events;
+    int64_t first, last;
+    int64_t index;
+    int64_t replayed = 0;
+    int found;
+
+    if ( maxBatch <= 0 )
+    {
+        handleError( dir, "batch must be at least 1, not %d", maxBatch );
+        return -1;
+    }
+
+    initCrc();
+
+    found = findSegments( dir, &first, &last );
+    if ( found <= 0 )
+        return found;
+
+    events = zmalloc( maxBatch * sizeof(disruptorEvent) );
+    for ( index = first; index <= last; ++index )
+    {
+        int64_t n = replaySegment( dir, index, fromSequence, handler, ctx, events, maxBatch );
+        if ( n < 0 )
+        {
+            replayed = -1;
+            break;
+        }
+        replayed += n;
+    }
+    zfree( events );
+
+    return replayed;
+}
+
+int64_t journalReplayInto( const char* dir, int64_t fromSequence, disruptor* d, int maxBatch )
+{
+    replayTarget t;
+    int64_t replayed;
+
+    if ( maxBatch <= 0 )
+    {
+        handleError( dir, "batch must be at least 1, not %d", maxBatch );
+        return -1;
+    }
+
+    t.d = d;
+    t.sizes = zmalloc( maxBatch * sizeof(size_t) );
+    t.failed = false;
+
+    replayed = journalReplay( dir, fromSequence, publishEvents, &t, maxBatch );
+
+    zfree( t.sizes );
+    return ( t.failed ? -1 : replayed );
+}
+
+/*-----------------------------------------------------------------------------
+* File-local function definitions.
+*----------------------------------------------------------------------------*/
+
+static bool startup( journal* j )
+{
+    int64_t first, last;
+    int found;
+
+    /* validate inputs. */
+    {
+        if ( j->options.syncPolicy < JOURNAL_SYNC_NONE || j->options.syncPolicy > JOURNAL_SYNC_INTERVAL )
+        {
+            handleError( j->dir, "invalid sync policy %d", j->options.syncPolicy );
+            return false;
+        }
+
+        if ( j->options.segmentSize == 0 )
+            j->options.segmentSize = JOURNAL_DEFAULT_SEGMENT_SIZE;
+        if ( j->options.syncIntervalMs == 0 )
+            j->options.syncIntervalMs = JOURNAL_DEFAULT_SYNC_INTERVAL;
+
+        if ( j->options.segmentSize < 4096 || j->options.syncIntervalMs < 0 )
+        {
+            handleError( j->dir, "segments must be at least 4096 bytes, and the sync interval positive" );
+            return false;
+        }
+    }
+
+    initCrc();
+
+    if ( mkdir( j->dir, 0755 ) < 0 && errno != EEXIST )
+    {
+        handleError( j->dir, "mkdir() error: %s", strerror(errno) );
+        return false;
+    }
+
+    /* carry on from the end of the last segment, if there is one. */
+    found = findSegments( j->dir, &first, &last );
+    if ( found < 0 )
+        return false;
+
+    j->syncedNs = getNs();
+    if ( found == 0 )
+    {
+        j->index = 0;
+        return createSegment( j );
+    }
+
+    j->index = last;
+    return openSegment( j );
+}
+
+static void shutdown( journal* j )
+{
+    closeSegment( j );
+}
+
+static void report( const char* dir, int level, const char* fmt, ... )
+{
+    char source[ 256 ];
+    va_list ap;
+
+    snprintf( source, sizeof( source ), "journal('%s')", dir );
+
+    va_start( ap, fmt );
+    loggerWritev( level, source, fmt, ap );
+    va_end( ap );
+}
+
+static int findSegments( const char* dir, int64_t* first, int64_t* last )
+{
+    DIR* d;
+    struct dirent* entry;
+    int found = 0;
+
+    d = opendir( dir );
+    if ( !d )
+    {
+        handleError( dir, "opendir() error: %s", strerror(errno) );
+        return -1;
+    }
+
+    while ( ( entry = readdir( d ) ) != NULL )
+    {
+        long long index;
+        char suffix[ 16 ];
+
+        if ( sscanf( entry->d_name, "%lld.%15s", &index, suffix ) != 2 || strcmp( suffix, "journal" ) != 0 )
+            continue;
+
+        if ( !found || index < *first )
+            *first = index;
+        if ( !found || index > *last )
+            *last = index;
+        found += 1;
+    }
+
+    closedir( d );
+    return found;
+}
+
+static bool createSegment( journal* j )
+{
+    segmentHeader* h;
+    char* name;
+    int error;
+
+    name = strformat( SEGMENT_NAME_FORMAT, j->dir, (long long)j->index );
+    handleDebug( j->dir, "creating segment %lld", (long long)j->index );
+
+    j->fd = open( name, O_RDWR | O_CREAT | O_EXCL, 0644 );
+    if ( j->fd < 0 )
+    {
+        handleError( j->dir, "open('%s') error: %s", name, strerror(errno) );
+        strfree( name );
+        return false;
+    }
+
+    /* allocate the blocks up front, so that running out of space is an
+     * error here rather than a SIGBUS while appending. */
+    error = posix_fallocate( j->fd, 0, j->options.segmentSize );
+    if ( error )
+    {
+        handleError( j->dir, "posix_fallocate('%s') error: %s", name, strerror(error) );
+        close( j->fd );
+        j->fd = -1;
+        unlink( name );
+        strfree( name );
+        return false;
+    }
+
+    /* and fault the pages in now, rather than one at a time as we append. */
+    j->map = mmap( NULL, j->options.segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, j->fd, 0 );
+    if ( j->map == MAP_FAILED )
+    {
+        handleError( j->dir, "mmap('%s') error: %s", name, strerror(errno) );
+        j->map = NULL;
+        close( j->fd );
+        j->fd = -1;
+        unlink( name );
+        strfree( name );
+        return false;
+    }
+    strfree( name );
+
+    h = (segmentHeader*)j->map;
+    memcpy( h->magic, SEGMENT_MAGIC, sizeof( h->magic ) );
+    h->version = SEGMENT_VERSION;
+    h->index = j->index;
+    h->segmentSize = j->options.segmentSize;
+
+    j->mapSize = j->options.segmentSize;
+    j->tail = sizeof(segmentHeader);
+    j->flushed = 0;
+    j->synced = 0;
+
+    /* make sure the new file itself survives a crash, too. */
+    if ( j->options.syncPolicy != JOURNAL_SYNC_NONE )
+        return syncDirectory( j->dir );
+
+    return true;
+}
+
+static bool openSegment( journal* j )
+{
+    const recordHeader* r;
+    struct stat info;
+    char* name;
+    int64_t offset;
+
+    name = strformat( SEGMENT_NAME_FORMAT, j->dir, (long long)j->index );
+
+    j->fd = open( name, O_RDWR );
+    if ( j->fd < 0 || fstat( j->fd, &info ) < 0 )
+    {
+        handleError( j->dir, "open('%s') error: %s", name, strerror(errno) );
+        strfree( name );
+        return false;
+    }
+
+    /* we crashed while creating it, before anything could be appended, so
+     * start it over. */
+    if ( isUnwritten( j->fd, info.st_size ) )
+    {
+        handleWarning( j->dir, "segment %lld was never finished; creating it again", (long long)j->index );
+        close( j->fd );
+        j->fd = -1;
+        if ( unlink( name ) < 0 )
+        {
+            handleError( j->dir, "unlink('%s') error: %s", name, strerror(errno) );
+            strfree( name );
+            return false;
+        }
+        strfree( name );
+        return createSegment( j );
+    }
+    strfree( name );
+
+    j->mapSize = info.st_size;
+    j->map = mmap( NULL, j->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, j->fd, 0 );
+    if ( j->map == MAP_FAILED )
+    {
+        handleError( j->dir, "mmap() error: %s", strerror(errno) );
+        j->map = NULL;
+        return false;
+    }
+
+    if ( memcmp( j->map, SEGMENT_MAGIC, sizeof( ( (segmentHeader*)0 )->magic ) ) != 0
+            || ( (segmentHeader*)j->map )->version != SEGMENT_VERSION )
+    {
+        handleError( j->dir, "segment %lld isn't a journal segment", (long long)j->index );
+        return false;
+    }
+
+    /* find the end of the records. */
+    offset = sizeof(segmentHeader);
+    while ( ( r = getRecord( j->map, j->mapSize, offset ) ) != NULL )
+    {
+        j->lastSequence = r->sequence;
+        offset += alignRecord( r->length );
+    }
+
+    /* whatever follows was torn by a crash, and pages of it may have
+     * reached the disk out of order.  cut it all off, so that none of it
+     * is mistaken for a record once we've appended up to it. */
+    if ( ftruncate( j->fd, offset ) < 0 || posix_fallocate( j->fd, 0, j->mapSize ) != 0 )
+    {
+        handleError( j->dir, "failed to truncate segment %lld: %s", (long long)j->index, strerror(errno) );
+        return false;
+    }
+
+    handleDebug( j->dir, "appending to segment %lld at offset %lld", (long long)j->index, (long long)offset );
+    j->tail = offset;
+    j->flushed = offset;
+    j->synced = offset;
+    return true;
+}
+
+static void closeSegment( journal* j )
+{
+    if ( j->map )
+    {
+        if ( j->options.syncPolicy != JOURNAL_SYNC_NONE )
+            syncRange( j, MS_SYNC );
+        munmap( j->map, j->mapSize );
+        j->map = NULL;
+    }
+
+    if ( j->fd >= 0 )
+    {
+        close( j->fd );
+        j->fd = -1;
+    }
+}
+
+static bool syncRange( journal* j, int flags )
+{
+    int64_t start;
+
+    /* starting writeback doesn't mean it finished, so a sync has to cover
+     * everything since the last sync, however much has been flushed. */
+    start = ( ( flags & MS_SYNC ) ? j->synced : j->flushed );
+    if ( !j->map || start == j->tail )
+        return true;
+
+    /* msync() wants a page aligned start. */
+    start &= ~(int64_t)( sysconf( _SC_PAGESIZE ) - 1 );
+    if ( msync( j->map + start, j->tail - start, flags ) < 0 )
+    {
+        handleError( j->dir, "msync() error: %s", strerror(errno) );
+        return false;
+    }
+
+    j->flushed = j->tail;
+    if ( flags & MS_SYNC )
+    {
+        j->synced = j->tail;
+        j->syncedNs = getNs();
+    }
+    return true;
+}
+
+static bool syncDirectory( const char* dir )
+{
+    int fd = open( dir, O_RDONLY | O_DIRECTORY );
+    bool ok;
+
+    if ( fd < 0 )
+    {
+        handleError( dir, "open() error: %s", strerror(errno) );
+        return false;
+    }
+
+    ok = ( fsync( fd ) == 0 );
+    if ( !ok )
+        handleError( dir, "fsync() error: %s", strerror(errno) );
+
+    close( fd );
+    return ok;
+}
+
+static bool isUnwritten( int fd, off_t size )
+{
+    char header[ sizeof(segmentHeader) ];
+    size_t i;
+
+    /* the header is written last when creating a segment, so a crash can
+     * leave one which is short, or still all zero. */
+    if ( size < (off_t)sizeof(header) )
+        return true;
+    if ( pread( fd, header, sizeof(header), 0 ) != sizeof(header) )
+        return false;
+
+    for ( i = 0; i < sizeof(header); ++i )
+    {
+        if ( header[ i ] )
+            return false;
+    }
+    return true;
+}
+
+static const recordHeader* getRecord( const char* map, int64_t size, int64_t offset )
+{
+    const recordHeader* r;
+
+    if ( offset + (int64_t)sizeof(recordHeader) > size )
+        return NULL;
+
+    /* the end of the records, or a record torn by a crash. */
+    r = (const recordHeader*)( map + offset );
+    if ( r->length < sizeof(recordHeader) || offset + r->length > size )
+        return NULL;
+    if ( r->senderLength == 0 || sizeof(recordHeader) + r->senderLength + r->size != r->length )
+        return NULL;
+    if ( crc32c( &r->length, r->length - sizeof(r->crc) ) != r->crc )
+        return NULL;
+
+    return r;
+}
+
+static int64_t replaySegment( const char* dir, int64_t index, int64_t fromSequence,
+        disruptorHandler handler, void* ctx, disruptorEvent* events, int maxBatch )
+{
+    const recordHeader* r;
+    struct stat info;
+    char* map;
+    char* name;
+    int64_t offset;
+    int64_t replayed = 0;
+    int count = 0;
+    int fd;
+
+    name = strformat( SEGMENT_NAME_FORMAT, dir, (long long)index );
+    fd = open( name, O_RDONLY );
+    strfree( name );
+
+    /* older segments may have been removed, and the newest may still be
+     * being created. */
+    if ( fd < 0 )
+    {
+        if ( errno == ENOENT )
+            return 0;
+        handleError( dir, "open() error: %s", strerror(errno) );
+        return -1;
+    }
+
+    if ( fstat( fd, &info ) < 0 || isUnwritten( fd, info.st_size ) )
+    {
+        close( fd );
+        return 0;
+    }
+
+    map = mmap( NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if ( map == MAP_FAILED )
+    {
+        handleError( dir, "mmap() error: %s", strerror(errno) );
+        return -1;
+    }
+    madvise( map, info.st_size, MADV_SEQUENTIAL );
+
+    if ( memcmp( map, SEGMENT_MAGIC, sizeof( ( (segmentHeader*)0 )->magic ) ) != 0
+            || ( (segmentHeader*)map )->version != SEGMENT_VERSION )
+    {
+        handleError( dir, "segment %lld isn't a journal segment", (long long)index );
+        munmap( map, info.st_size );
+        return -1;
+    }
+
+    offset = sizeof(segmentHeader);
+    while ( ( r = getRecord( map, info.st_size, offset ) ) != NULL )
+    {
+        disruptorEvent* e;
+
+        offset += alignRecord( r->length );
+        if ( r->sequence < fromSequence )
+            continue;
+
+        /* there's at least one more, so this can't be the end. */
+        if ( count == maxBatch )
+        {
+            handler( ctx, events, count, false );
+            count = 0;
+        }
+
+        e = &events[ count++ ];
+        e->msg = 0;
+        e->sequence = r->sequence;
+        e->timestampNs = r->timestampNs;
+        e->sender = (const char*)( r + 1 );
+        e->senderId = r->senderId;
+        e->data = (char*)( r + 1 ) + r->senderLength;
+        e->size = r->size;
+        replayed += 1;
+    }
+
+    if ( count )
+        handler( ctx, events, count, true );
+
+    munmap( map, info.st_size );
+    return replayed;
+}
+
+static void appendEvents( void* ctx, const disruptorEvent* events, int count, bool endOfBatch )
+{
+    journal* j = ctx;
+    int i;
+
+    for ( i = 0; i < count; ++i )
+    {
+        if ( !journalAppend( j, &events[ i ] ) )
+            j->failed = true;
+    }
+
+    if ( endOfBatch && !journalFlush( j ) )
+        j->failed = true;
+}
+
+static void publishEvents( void* ctx, const disruptorEvent* events, int count, bool endOfBatch )
+{
+    replayTarget* t = ctx;
+    char** ptrs;
+    int i;
+
+    (void)endOfBatch;
+
+    if ( t->failed )
+        return;
+
+    for ( i = 0; i < count; ++i )
+        t->sizes[ i ] = events[ i ].size;
+
+    ptrs = disruptorClaimBatch( t->d, count, t->sizes );
+    if ( ptrs )
+    {
+        for ( i = 0; i < count; ++i )
+            memcpy( ptrs[ i ], events[ i ].data, events[ i ].size );
+        if ( !disruptorPublishBatch( t->d ) )
+            t->failed = true;
+        return;
+    }
+
+    /* too much for the ring or the send buffer at once; send them one at a
+     * time instead. */
+    for ( i = 0; i < count; ++i )
+    {
+        if ( !disruptorSend( t->d, events[ i ].data, events[ i ].size ) )
+        {
+            t->failed = true;
+            return;
+        }
+    }
+}
+
+static int64_t alignRecord( int64_t length )
+{
+    return ( ( length + RECORD_ALIGNMENT - 1 ) & ~(int64_t)( RECORD_ALIGNMENT - 1 ) );
+}
+
+static int64_t getNs()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ( (int64_t)ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec );
+}
+
+static void initCrc()
+{
+    uint32_t i, j;
+
+    if ( crcReady )
+        return;
+
+    for ( i = 0; i < 256; ++i )
+    {
+        uint32_t crc = i;
+        for ( j = 0; j < 8; ++j )
+            crc = ( crc & 1 ? ( crc >> 1 ) ^ CRC32C_POLYNOMIAL : crc >> 1 );
+        crcTable[ 0 ][ i ] = crc;
+    }
+
+    /* tables for the next seven bytes, so that eight are done at once. */
+    for ( i = 0; i < 256; ++i )
+    {
+        for ( j = 1; j < 8; ++j )
+            crcTable[ j ][ i ] = ( crcTable[ j - 1 ][ i ] >> 8 ) ^ crcTable[ 0 ][ crcTable[ j - 1 ][ i ] & 0xff ];
+    }
+
+#if defined( __x86_64__ )
+    {
+        uint32_t eax, ebx, ecx, edx;
+
+        /* bit 20 of the feature flags is sse4.2, which has crc32. */
+        __asm__ volatile( "cpuid"
+                : "=a"( eax ), "=b"( ebx ), "=c"( ecx ), "=d"( edx )
+                : "a"( 1 ) );
+        crcHardware = ( ( ecx & ( 1 << 20 ) ) != 0 );
+    }
+#endif
+
+    crcReady = true;
+}
+
+static uint32_t crc32c( const void* data, size_t size )
+{
+    const unsigned char* p = data;
+    uint32_t crc = 0xffffffff;
+
+#if defined( __x86_64__ )
+    if ( crcHardware )
+    {
+        uint64_t crc64 = crc;
+
+        for ( ; size >= 8; p += 8, size -= 8 )
+        {
+            uint64_t v;
+            memcpy( &v, p, sizeof( v ) );
+            __asm__( "crc32q %1, %0" : "+r"( crc64 ) : "rm"( v ) );
+        }
+
+        crc = (uint32_t)crc64;
+        for ( ; size > 0; ++p, --size )
+            __asm__( "crc32b %1, %0" : "+r"( crc ) : "rm"( *p ) );
+
+        return ~crc;
+    }
+#endif
+
+    for ( ; size >= 8; p += 8, size -= 8 )
+    {
+        uint32_t lo = crc ^ ( p[0] | ( p[1] << 8 ) | ( p[2] << 16 ) | ( (uint32_t)p[3] << 24 ) );
+        crc = crcTable[ 7 ][ lo & 0xff ] ^ crcTable[ 6 ][ ( lo >> 8 ) & 0xff ]
+            ^ crcTable[ 5 ][ ( lo >> 16 ) & 0xff ] ^ crcTable[ 4 ][ lo >> 24 ]
+            ^ crcTable[ 3 ][ p[4] ] ^ crcTable[ 2 ][ p[5] ]
+            ^ crcTable[ 1 ][ p[6] ] ^ crcTable[ 0 ][ p[7] ];
+    }
+
+    for ( ; size > 0; ++p, --size )
+        crc = ( crc >> 8 ) ^ crcTable[ 0 ][ ( crc ^ *p ) & 0xff ];
+
+    return ~crc;
+}
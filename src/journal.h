@@ -0,0 +1,88 @@
+#ifndef __DISRUPTOR_JOURNAL_H__
+#define __DISRUPTOR_JOURNAL_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "disruptor.h"
+
+/*-----------------------------------------------------------------------------
+* Declarations
+*----------------------------------------------------------------------------*/
+
+/* an append-only log of received messages, kept in a directory of fixed
+ * size segment files which are written through memory maps.  every record
+ * carries a crc32c, so that a record torn by a crash is detected, and
+ * dropped, when the journal is next opened or replayed. */
+struct journal;
+typedef struct journal journal;
+
+/* how far each batch is pushed towards the disk before its slots in the
+ * ring are released: not at all, leaving it to the kernel; writeback
+ * started but not waited for; written and waited for; or written and
+ * waited for at most once every syncIntervalMs. */
+#define JOURNAL_SYNC_NONE       0
+#define JOURNAL_SYNC_ASYNC      1
+#define JOURNAL_SYNC_BATCH      2
+#define JOURNAL_SYNC_INTERVAL   3
+
+/* options for journalOpen(); zero-initialize for the defaults. */
+typedef struct journalOptions
+{
+    int syncPolicy;
+    int64_t syncIntervalMs;
+
+    /* the size of each segment file, which limits the size of a record.
+     * defaults to JOURNAL_DEFAULT_SEGMENT_SIZE. */
+    int64_t segmentSize;
+} journalOptions;
+
+#define JOURNAL_DEFAULT_SEGMENT_SIZE    ( 64 * 1024 * 1024 )
+#define JOURNAL_DEFAULT_SYNC_INTERVAL   1000
+
+/*-----------------------------------------------------------------------------
+* Function prototypes
+*----------------------------------------------------------------------------*/
+
+/* open the journal in 'dir' for appending, creating the directory if need
+ * be.  only one process may append to a journal at a time. */
+journal* journalOpen( const char* dir, const journalOptions* options );
+void journalRelease( journal* j );
+
+/* append one record; the sequence, timestamp, sender and payload are kept.
+ * nothing is synced until journalFlush() or journalSync().  fails if the
+ * event has a size but no data, as when its sender couldn't be mapped. */
+bool journalAppend( journal* j, const disruptorEvent* e );
+
+/* apply the sync policy to everything appended since the last flush. */
+bool journalFlush( journal* j );
+
+/* write everything appended so far to the disk and wait for it. */
+bool journalSync( journal* j );
+
+/* the sequence of the last record appended, or -1 if there are none in
+ * the current segment. */
+int64_t journalGetLastSequence( journal* j );
+
+/* the journaller's loop: receive from 'd' through disruptorProcess(),
+ * append each message, and flush at the end of every batch, before the
+ * batch's slots are released.  waits up to 'timeoutMs' for messages, as
+ * disruptorProcessWait() does.  returns how many were appended, or -1 if
+ * any couldn't be, in which case the rest of that batch is lost. */
+int64_t journalRecord( journal* j, disruptor* d, int maxBatch, int64_t timeoutMs );
+
+/* read back every record in 'dir' with a sequence of at least
+ * 'fromSequence', and pass them to 'handler' at most 'maxBatch' at a time.
+ * events point into the journal's mapping, so 'data' and 'sender' are
+ * only valid until the handler returns, and 'msg' is zero.  'endOfBatch'
+ * is set on the last call for each segment.  returns how many were
+ * replayed, or -1 on error. */
+int64_t journalReplay( const char* dir, int64_t fromSequence, disruptorHandler handler, void* ctx,
+        int maxBatch );
+
+/* as journalReplay(), but publish each record's payload to 'd', up to
+ * 'maxBatch' at a time.  the messages are sent by 'd', and get new
+ * sequences and timestamps. */
+int64_t journalReplayInto( const char* dir, int64_t fromSequence, disruptor* d, int maxBatch );
+
+#endif
+
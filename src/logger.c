@@ -0,0 +1,101 @@
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* long messages are truncated. */
+#define MAX_MESSAGE_LENGTH      1024
+
+/* forward declarations. */
+static void writeToStderr( void* ctx, int level, const char* source, const char* message );
+static int getInitialLevel();
+
+/* per-process settings; the level is read from the environment on first
+ * use, unless it's been set. */
+#define LEVEL_UNSET             -1
+static int currentLevel = LEVEL_UNSET;
+static loggerSink currentSink = writeToStderr;
+static void* currentCtx = NULL;
+
+/*-----------------------------------------------------------------------------
+* Public API definitions.
+*----------------------------------------------------------------------------*/
+
+void loggerSetLevel( int level )
+{
+    currentLevel = level;
+}
+
+int loggerGetLevel()
+{
+    if ( currentLevel == LEVEL_UNSET )
+        currentLevel = getInitialLevel();
+    return currentLevel;
+}
+
+void loggerSetSink( loggerSink sink, void* ctx )
+{
+    currentSink = ( sink ? sink : writeToStderr );
+    currentCtx = ( sink ? ctx : NULL );
+}
+
+const char* loggerGetLevelName( int level )
+{
+    switch ( level )
+    {
+    case LOGGER_TRACE: return "trace";
+    case LOGGER_DEBUG: return "debug";
+    case LOGGER_INFO: return "info";
+    case LOGGER_WARNING: return "warning";
+    case LOGGER_ERROR: return "error";
+    }
+    return "unknown";
+}
+
+void loggerWrite( int level, const char* source, const char* fmt, ... )
+{
+    va_list ap;
+    va_start( ap, fmt );
+    loggerWritev( level, source, fmt, ap );
+    va_end( ap );
+}
+
+void loggerWritev( int level, const char* source, const char* fmt, va_list ap )
+{
+    char message[ MAX_MESSAGE_LENGTH ];
+
+    vsnprintf( message, sizeof( message ), fmt, ap );
+    currentSink( currentCtx, level, source, message );
+}
+
+/*-----------------------------------------------------------------------------
+* File-local function definitions.
+*----------------------------------------------------------------------------*/
+
+static void writeToStderr( void* ctx, int level, const char* source, const char* message )
+{
+    (void)ctx;
+
+    /* one call, so that lines from several threads don't interleave. */
+    fprintf( stderr, "%s %s: %s\n", source, loggerGetLevelName( level ), message );
+}
+
+static int getInitialLevel()
+{
+    const char* name = getenv( "DISRUPTOR_LOG_LEVEL" );
+    int level;
+
+    if ( name )
+    {
+        for ( level = LOGGER_TRACE; level < LOGGER_NONE; ++level )
+        {
+            if ( strcmp( name, loggerGetLevelName( level ) ) == 0 )
+                return level;
+        }
+        if ( strcmp( name, "none" ) == 0 )
+            return LOGGER_NONE;
+    }
+
+    return LOGGER_INFO;
+}
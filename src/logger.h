@@ -0,0 +1,66 @@
+#ifndef __DISRUPTOR_LOGGER_H__
+#define __DISRUPTOR_LOGGER_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include "util.h"
+
+/*-----------------------------------------------------------------------------
+* Declarations
+*----------------------------------------------------------------------------*/
+
+/* levels. */
+#define LOGGER_TRACE            0
+#define LOGGER_DEBUG            1
+#define LOGGER_INFO             2
+#define LOGGER_WARNING          3
+#define LOGGER_ERROR            4
+#define LOGGER_NONE             5
+
+/* messages below this level are compiled out altogether, so that logging
+ * on hot paths costs nothing unless it's asked for at build time, e.g. with
+ * 'make LOG_LEVEL=TRACE'. */
+#ifndef LOGGER_MIN_LEVEL
+# define LOGGER_MIN_LEVEL       LOGGER_DEBUG
+#endif
+
+/* receives each message which passes both the compile-time and run-time
+ * levels.  'source' names the object which logged it, e.g. "shmem('x')". */
+typedef void (*loggerSink)( void* ctx, int level, const char* source, const char* message );
+
+/*-----------------------------------------------------------------------------
+* Function prototypes
+*----------------------------------------------------------------------------*/
+
+/* messages below 'level' are dropped at run time.  defaults to the level
+ * named by $DISRUPTOR_LOG_LEVEL, e.g. "debug", or else LOGGER_INFO. */
+void loggerSetLevel( int level );
+int loggerGetLevel();
+
+/* send messages to 'sink' rather than stderr.  pass NULL to restore stderr. */
+void loggerSetSink( loggerSink sink, void* ctx );
+
+/* "trace", "debug", "info", "warning" or "error". */
+const char* loggerGetLevelName( int level );
+
+/* formats a message and hands it to the sink.  callers should check
+ * loggerEnabled() first, or go through loggerReport(). */
+void loggerWrite( int level, const char* source, const char* fmt, ... );
+void loggerWritev( int level, const char* source, const char* fmt, va_list ap );
+
+/*-----------------------------------------------------------------------------
+* Macros
+*----------------------------------------------------------------------------*/
+
+#define loggerEnabled( level ) \
+    ( (level) >= LOGGER_MIN_LEVEL && (level) >= loggerGetLevel() )
+
+/* calls report( obj, level, fmt, ... ) if 'level' is enabled.  the
+ * compile-time test is constant, so calls below LOGGER_MIN_LEVEL vanish,
+ * arguments and all. */
+#define loggerReport( report, obj, level, ... ) \
+    do { if ( loggerEnabled( level ) ) report( obj, level, __VA_ARGS__ ); } while ( 0 )
+
+#endif
+
@@ -2,32 +2,103 @@
 
 #include "util.h"
 #include "zmalloc.h"
+#include "atomics.h"
+#include "logger.h"
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
 #include <stdarg.h>
 
+/* constants. */
+#define CACHE_LINE_SIZE         64
+
+/* map states. */
+#define MAP_EMPTY               0
+#define MAP_FORMATTING          1
+#define MAP_READY               2
+
+/* bucket states and flags, stored in the low bits beside the key's hash. */
+#define BUCKET_EMPTY            0
+#define BUCKET_CLAIMED          1
+#define BUCKET_READY            2
+#define BUCKET_STATE_MASK       3
+#define BUCKET_NEW              (1 << 2)
+#define BUCKET_BITS             3
+#define BUCKET_BITS_MASK        ( ( 1 << BUCKET_BITS ) - 1 )
+
+/* lives at the start of the shared memory. */
+typedef struct sharedMap
+{
+    int64_t state;
+    int64_t itemSize;
+    int64_t bucketSize;
+    int64_t bucketsCount;
+    int64_t itemsCount;
+    int64_t padding[3];
+} sharedMap;
+
+/* one per bucket; the item's value follows immediately, so that a key and
+ * a small value share a cache line. */
+typedef struct sharedBucket
+{
+    /* the key's hash, or'd with a BUCKET_* state and flags.  the key is
+     * written before the bucket is marked ready, with release ordering. */
+    int64_t state;
+    char key[ SHMAP_MAX_KEY_LENGTH + 1 ];
+} sharedBucket;
+
 struct shmap
 {
     char*   name;
     char*   mem;
     int64_t size;
     int64_t itemSize;
+
+    sharedMap* header;
+    char* buckets;
+    int64_t bucketSize;
+    int64_t bucketsMask;
+
+    /* iteration is per-process. */
+    int64_t iterator;
 };
 
+/* logging; see logger.h. */
+#define handleError( s, ... )   loggerReport( report, s, LOGGER_ERROR, __VA_ARGS__ )
+
 /* forward declarations. */
 static bool startup( shmap* s );
 static void shutdown( shmap* s );
-static void handleError( shmap* s, const char* fmt, ... );
+static void report( shmap* s, int level, const char* fmt, ... );
+static int64_t getBucketSize( size_t itemSize );
+static int64_t hashKey( const char* key );
+static sharedBucket* getBucket( shmap* s, SharedHandle h );
+static void waitUntilReady( sharedBucket* b );
 
 /*-----------------------------------------------------------------------------
 * Public API definitions.
 *----------------------------------------------------------------------------*/
 
+int64_t shmapGetMemSize( size_t itemSize, int64_t capacity )
+{
+    int64_t count = 1;
+
+    /* keep the load factor at or below one half. */
+    while ( count < 2 * capacity )
+        count <<= 1;
+
+    return ( CACHE_LINE_SIZE + sizeof(sharedMap) + count * getBucketSize( itemSize ) );
+}
+
 shmap* shmapCreate( void* mem, int64_t memSize, size_t itemSize, const char* debugName, ... )
 {
     shmap* s = zcalloc( sizeof( shmap ) );
-    s->name = strformat( debugName, (char*)(&debugName + 1) );
+    {
+        va_list ap;
+        va_start( ap, debugName );
+        s->name = vstrformat( debugName, ap );
+        va_end( ap );
+    }
     s->mem = (char*)mem;
     s->size = memSize;
     s->itemSize = itemSize;
@@ -49,25 +120,226 @@ void shmapRelease( shmap* s )
     zfree( s );
 }
 
+int64_t shmapGetCount( shmap* s )
+{
+    return atomicLoadRelaxed64( &s->header->itemsCount );
+}
+
+int64_t shmapGetCapacity( shmap* s )
+{
+    return ( s->bucketsMask + 1 );
+}
+
+const char* shmapGetKey( shmap* s, SharedHandle h )
+{
+    sharedBucket* b = getBucket( s, h );
+    if ( !b )
+        return NULL;
+    return b->key;
+}
+
+void* shmapGetValue( shmap* s, SharedHandle h )
+{
+    sharedBucket* b = getBucket( s, h );
+    if ( !b )
+        return NULL;
+    return ( (char*)b + sizeof(sharedBucket) );
+}
+
+bool shmapIsNew( shmap* s, SharedHandle h )
+{
+    sharedBucket* b = getBucket( s, h );
+    if ( !b )
+        return false;
+    return ( ( atomicLoadAcquire64( &b->state ) & BUCKET_NEW ) != 0 );
+}
+
+void shmapSetNew( shmap* s, SharedHandle h, bool isNew )
+{
+    sharedBucket* b = getBucket( s, h );
+    int64_t state;
+    int64_t prev;
+
+    if ( !b )
+        return;
+
+    /* the cas also publishes the value before the flag change. */
+    state = atomicLoadRelaxed64( &b->state );
+    do
+    {
+        prev = state;
+        state = cas64( &b->state, prev, ( isNew ? prev | BUCKET_NEW : prev & ~(int64_t)BUCKET_NEW ) );
+    } while ( state != prev );
+}
+
+SharedHandle shmapFindItem( shmap* s, const char* key )
+{
+    int64_t hash = hashKey( key );
+    int64_t i;
+
+    for ( i = 0; i <= s->bucketsMask; ++i )
+    {
+        int64_t index = ( ( ( hash >> BUCKET_BITS ) + i ) & s->bucketsMask );
+        sharedBucket* b = (sharedBucket*)( s->buckets + index * s->bucketSize );
+        int64_t state = atomicLoadAcquire64( &b->state );
+
+        /* an empty bucket ends the probe sequence. */
+        if ( state == BUCKET_EMPTY )
+            return 0;
+
+        if ( ( state & ~(int64_t)BUCKET_BITS_MASK ) != hash )
+            continue;
+
+        /* someone's still writing the key; it may be ours. */
+        if ( ( state & BUCKET_STATE_MASK ) != BUCKET_READY )
+            waitUntilReady( b );
+
+        if ( strcmp( b->key, key ) == 0 )
+            return ( index + 1 );
+    }
+
+    return 0;
+}
+
+SharedHandle shmapGetItem( shmap* s, const char* key )
+{
+    int64_t hash = hashKey( key );
+    int64_t i;
+
+    if ( strlen( key ) > SHMAP_MAX_KEY_LENGTH )
+    {
+        handleError( s, "key '%s' is longer than %d characters.", key, SHMAP_MAX_KEY_LENGTH );
+        return 0;
+    }
+
+    for ( i = 0; i <= s->bucketsMask; ++i )
+    {
+        int64_t index = ( ( ( hash >> BUCKET_BITS ) + i ) & s->bucketsMask );
+        sharedBucket* b = (sharedBucket*)( s->buckets + index * s->bucketSize );
+        int64_t state = atomicLoadAcquire64( &b->state );
+
+        /* try to claim an empty bucket.  if someone beats us to it, then
+         * look at what they put there. */
+        if ( state == BUCKET_EMPTY )
+        {
+            state = cas64( &b->state, BUCKET_EMPTY, hash | BUCKET_CLAIMED );
+            if ( state == BUCKET_EMPTY )
+            {
+                strcpy( b->key, key );
+                atomicStoreRelease64( &b->state, hash | BUCKET_READY | BUCKET_NEW );
+                xadd64( &s->header->itemsCount, 1 );
+                return ( index + 1 );
+            }
+        }
+
+        if ( ( state & ~(int64_t)BUCKET_BITS_MASK ) != hash )
+            continue;
+
+        if ( ( state & BUCKET_STATE_MASK ) != BUCKET_READY )
+            waitUntilReady( b );
+
+        if ( strcmp( b->key, key ) == 0 )
+            return ( index + 1 );
+    }
+
+    handleError( s, "map is full." );
+    return 0;
+}
+
+SharedHandle shmapGetFirst( shmap* s )
+{
+    s->iterator = 0;
+    return shmapGetNext( s );
+}
+
+SharedHandle shmapGetNext( shmap* s )
+{
+    /* items are never removed, so a plain scan sees every item which was
+     * inserted before it started. */
+    while ( s->iterator <= s->bucketsMask )
+    {
+        int64_t index = s->iterator++;
+        sharedBucket* b = (sharedBucket*)( s->buckets + index * s->bucketSize );
+
+        if ( ( atomicLoadAcquire64( &b->state ) & BUCKET_STATE_MASK ) == BUCKET_READY )
+            return ( index + 1 );
+    }
+
+    return 0;
+}
+
 /*-----------------------------------------------------------------------------
 * File-local function definitions.
 *----------------------------------------------------------------------------*/
 
 static bool startup( shmap* s )
 {
+    char* start;
+    int64_t available;
+    int64_t count;
+
     /* validate inputs. */
     {
+        /* check for null memory. */
+        if ( !s->mem )
+        {
+            handleError( s, "invalid memory." );
+            return false;
+        }
+
         /* too short? */
         if ( s->size <= 0 )
         {
             handleError( s, "memory not large enough." );
             return false;
         }
+    }
 
-        /* check for slashes in the name. */
-        if ( !s->mem )
+    /* keep everything on cache line boundaries.  each process maps the
+     * memory at a page boundary, so everyone agrees on the padding. */
+    start = (char*)( ( (uintptr_t)s->mem + CACHE_LINE_SIZE - 1 ) & ~(uintptr_t)( CACHE_LINE_SIZE - 1 ) );
+    available = ( s->size - ( start - s->mem ) - (int64_t)sizeof(sharedMap) );
+    s->bucketSize = getBucketSize( s->itemSize );
+
+    /* use the largest power of two number of buckets which fits. */
+    count = 1;
+    while ( 2 * count * s->bucketSize <= available )
+        count <<= 1;
+
+    if ( count * s->bucketSize > available )
+    {
+        handleError( s, "memory not large enough." );
+        return false;
+    }
+
+    s->header = (sharedMap*)start;
+    s->buckets = ( start + sizeof(sharedMap) );
+    s->bucketsMask = ( count - 1 );
+
+    /* format the memory, or wait for whoever is formatting it. */
+    {
+        sharedMap* m = s->header;
+        int64_t state = cas64( &m->state, MAP_EMPTY, MAP_FORMATTING );
+
+        if ( state == MAP_EMPTY )
         {
-            handleError( s, "invalid memory." );
+            memset( s->buckets, 0, count * s->bucketSize );
+            m->itemSize = s->itemSize;
+            m->bucketSize = s->bucketSize;
+            m->bucketsCount = count;
+            m->itemsCount = 0;
+            atomicStoreRelease64( &m->state, MAP_READY );
+        }
+        else
+        {
+            while ( atomicLoadAcquire64( &m->state ) != MAP_READY )
+                atomicYield();
+        }
+
+        if ( m->itemSize != s->itemSize || m->bucketsCount != count )
+        {
+            handleError( s, "memory holds a map of %d buckets of %d bytes; expected %d of %d.",
+                    (int)m->bucketsCount, (int)m->itemSize, (int)count, (int)s->itemSize );
             return false;
         }
     }
@@ -77,16 +349,50 @@ static bool startup( shmap* s )
 
 static void shutdown( shmap* s )
 {
-    (void)s;
+    s->header = NULL;
+    s->buckets = NULL;
 }
 
-static void handleError( shmap* s, const char* fmt, ... )
+static void report( shmap* s, int level, const char* fmt, ... )
 {
+    char source[ 128 ];
     va_list ap;
+
+    snprintf( source, sizeof( source ), "shmap('%s')", s->name );
+
     va_start( ap, fmt );
-    fprintf( stderr, "shmap('%s') error: ", s->name );
-    vfprintf( stderr, fmt, ap );
-    fprintf( stderr, "\n" );
+    loggerWritev( level, source, fmt, ap );
     va_end( ap );
 }
 
+static int64_t getBucketSize( size_t itemSize )
+{
+    int64_t size = ( sizeof(sharedBucket) + itemSize );
+    return ( ( size + CACHE_LINE_SIZE - 1 ) & ~(int64_t)( CACHE_LINE_SIZE - 1 ) );
+}
+
+static int64_t hashKey( const char* key )
+{
+    /* FNV-1a, with room for the state bits. */
+    uint64_t hash = 14695981039346656037ULL;
+    while ( *key )
+    {
+        hash ^= (unsigned char)*key++;
+        hash *= 1099511628211ULL;
+    }
+    return (int64_t)( hash & ~(uint64_t)BUCKET_BITS_MASK );
+}
+
+static sharedBucket* getBucket( shmap* s, SharedHandle h )
+{
+    if ( h <= 0 || h > s->bucketsMask + 1 )
+        return NULL;
+    return (sharedBucket*)( s->buckets + ( h - 1 ) * s->bucketSize );
+}
+
+static void waitUntilReady( sharedBucket* b )
+{
+    /* the key is only a few bytes, so this won't take long. */
+    while ( ( atomicLoadAcquire64( &b->state ) & BUCKET_STATE_MASK ) != BUCKET_READY )
+        atomicPause();
+}
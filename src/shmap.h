@@ -14,21 +14,39 @@ typedef struct shmap shmap;
 
 typedef int64_t SharedHandle;
 
+/* the longest key an item can have. */
+#define SHMAP_MAX_KEY_LENGTH    47
+
 /*-----------------------------------------------------------------------------
 * Function prototypes
 *----------------------------------------------------------------------------*/
 
+/* the memory needed to hold 'capacity' items of 'itemSize' bytes. */
+int64_t shmapGetMemSize( size_t itemSize, int64_t capacity );
+
+/* the first process to attach to 'mem' formats it; everyone else must pass
+ * the same itemSize. */
 shmap* shmapCreate( void* mem, int64_t memSize, size_t itemSize, const char* debugName, ... );
 void shmapRelease( shmap* s );
 
+int64_t shmapGetCount( shmap* s );
+int64_t shmapGetCapacity( shmap* s );
+
 const char* shmapGetKey( shmap* s, SharedHandle h );
 void* shmapGetValue( shmap* s, SharedHandle h );
+
+/* an item is new from its insertion until someone clears the flag, which
+ * is typically done by whoever fills in its value. */
 bool shmapIsNew( shmap* s, SharedHandle h );
-void shmapSetNew( shmap* s, SharedHandle h );
+void shmapSetNew( shmap* s, SharedHandle h, bool isNew );
 
+/* returns 0 if the key isn't present. */
 SharedHandle shmapFindItem( shmap* s, const char* key );
+
+/* inserts the key if it isn't present; returns 0 if the map is full. */
 SharedHandle shmapGetItem( shmap* s, const char* key );
 
+/* iterate over every item; returns 0 at the end. */
 SharedHandle shmapGetFirst( shmap* s );
 SharedHandle shmapGetNext( shmap* s );
 
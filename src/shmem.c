@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #define _LARGEFILE64_SOURCE
 #define _USE_FILE_OFFSET64
 #define _USE_LARGEFILE64
@@ -5,6 +6,7 @@
 
 #include "util.h"
 #include "zmalloc.h"
+#include "logger.h"
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
@@ -20,19 +22,32 @@ struct shmem
 #if _MSC_VER
 #else
     int     fd;
+
+    /* our connection to the broker, if any.  the broker counts these to
+     * know when nobody has any of its segments open. */
+    int     broker;
 #endif
 
     void*   mapped;
 };
 
+/* logging; see logger.h. */
+#define handleError( s, ... )   loggerReport( report, s, LOGGER_ERROR, __VA_ARGS__ )
+#define handleWarning( s, ... ) loggerReport( report, s, LOGGER_WARNING, __VA_ARGS__ )
+#define handleInfo( s, ... )    loggerReport( report, s, LOGGER_INFO, __VA_ARGS__ )
+#define handleDebug( s, ... )   loggerReport( report, s, LOGGER_DEBUG, __VA_ARGS__ )
+
 /* forward declarations. */
 static bool startup( shmem* s );
-static void shutdown( shmem* s );
-static void handleError( shmem* s, const char* fmt, ... );
-static void handleInfo( shmem* s, const char* fmt, ... );
+static void cleanup( shmem* s );
+static void report( shmem* s, int level, const char* fmt, ... );
 static void platformUnlink( const char* name );
+static void platformUnlinkPrefix( const char* prefix );
 static bool platformStartup( shmem* s );
 static void platformShutdown( shmem* s );
+static bool platformBind( shmem* s, int node );
+static bool platformPrefault( shmem* s, int64_t pageSize );
+static bool platformRunBroker( const char* brokerName );
 
 /*-----------------------------------------------------------------------------
 * Public API definitions.
@@ -44,13 +59,26 @@ void shmemUnlink( const char* formatName, ... )
     va_start( ap, formatName );
     {
         char* fullname = vstrformat( formatName, ap );
-        handleInfo( NULL, "shmemUnlink('%s')", fullname );
+        handleDebug( NULL, "shmemUnlink('%s')", fullname );
         platformUnlink( fullname );
         strfree( fullname );
     }
     va_end( ap );
 }
 
+void shmemUnlinkPrefix( const char* formatPrefix, ... )
+{
+    va_list ap;
+    va_start( ap, formatPrefix );
+    {
+        char* prefix = vstrformat( formatPrefix, ap );
+        handleDebug( NULL, "shmemUnlinkPrefix('%s')", prefix );
+        platformUnlinkPrefix( prefix );
+        strfree( prefix );
+    }
+    va_end( ap );
+}
+
 shmem* shmemOpen( int64_t size, int flags, const char* formatName, ... )
 {
     shmem* s = zcalloc( sizeof( shmem ) );
@@ -62,7 +90,11 @@ shmem* shmemOpen( int64_t size, int flags, const char* formatName, ... )
     }
     s->size = size;
     s->flags = flags;
-    handleInfo( s, "open(size=%u, flags=%d)", (unsigned int)size, flags );
+#if !_MSC_VER
+    s->fd = -1;
+    s->broker = -1;
+#endif
+    handleDebug( s, "open(size=%u, flags=%d)", (unsigned int)size, flags );
     if ( !startup( s ) )
     {
         shmemClose( s );
@@ -77,9 +109,9 @@ void shmemClose( shmem* s )
         return;
 
 #if 0
-    handleInfo( s, "close()" );
+    handleDebug( s, "close()" );
 #endif
-    shutdown( s );
+    cleanup( s );
     strfree( s->name );
     zfree( s );
 }
@@ -100,6 +132,17 @@ void* shmemGetPtr( shmem* s )
     return s->mapped;
 }
 
+bool shmemRunBroker( const char* brokerName )
+{
+    if ( strlen( brokerName ) <= 0 )
+    {
+        handleError( NULL, "broker name too short." );
+        return false;
+    }
+
+    return platformRunBroker( brokerName );
+}
+
 /*-----------------------------------------------------------------------------
 * File-local function definitions.
 *----------------------------------------------------------------------------*/
@@ -128,6 +171,12 @@ static bool startup( shmem* s )
         bool mustCreate = (s->flags & SHMEM_MUST_CREATE);
         bool mustNotCreate = (s->flags & SHMEM_MUST_NOT_CREATE);
 
+        if ( mustCreate && ( s->flags & SHMEM_READ_ONLY ) )
+        {
+            handleError( s, "can't create a segment read-only" );
+            return false;
+        }
+
         if ( mustCreate || mustNotCreate )
         {
             if ( mustCreate == mustNotCreate )
@@ -136,39 +185,32 @@ static bool startup( shmem* s )
                 return false;
             }
         }
+
+        /* locking the pages in faults them all in anyway. */
+        if ( s->flags & SHMEM_LOCK )
+            s->flags |= SHMEM_PREFAULT;
     }
 
     return platformStartup( s );
 }
 
-static void shutdown( shmem* s )
+static void cleanup( shmem* s )
 {
     platformShutdown( s );
 }
 
-static void handleError( shmem* s, const char* fmt, ... )
+static void report( shmem* s, int level, const char* fmt, ... )
 {
+    char source[ 128 ];
     va_list ap;
-    va_start( ap, fmt );
+
     if ( s )
-        fprintf( stderr, "shmem('%s') error: ", s->name );
+        snprintf( source, sizeof( source ), "shmem('%s')", s->name );
     else
-        fprintf( stderr, "shmem error: " );
-    vfprintf( stderr, fmt, ap );
-    fprintf( stderr, "\n" );
-    va_end( ap );
-}
+        snprintf( source, sizeof( source ), "shmem" );
 
-static void handleInfo( shmem* s, const char* fmt, ... )
-{
-    va_list ap;
     va_start( ap, fmt );
-    if ( s )
-        fprintf( stdout, "shmem('%s') info: ", s->name );
-    else
-        fprintf( stdout, "shmem info: " );
-    vfprintf( stdout, fmt, ap );
-    fprintf( stdout, "\n" );
+    loggerWritev( level, source, fmt, ap );
     va_end( ap );
 }
 
@@ -184,31 +226,284 @@ static void handleInfo( shmem* s, const char* fmt, ... )
 # include <sys/stat.h>
 # include <unistd.h>
 # include <fcntl.h>
+# include <stdlib.h>
+# include <stddef.h>
+# include <dirent.h>
+# include <poll.h>
+# include <sys/syscall.h>
+# include <sys/socket.h>
+# include <sys/un.h>
 extern int ftruncate64( int fd, off64_t length );
+
+/* from <numaif.h>, so as not to need libnuma. */
+# ifndef MPOL_BIND
+#  define MPOL_BIND             2
+# endif
+# ifndef MPOL_MF_MOVE
+#  define MPOL_MF_MOVE          (1 << 1)
+# endif
+
+/* linux 5.14 and up. */
+# ifndef MADV_POPULATE_READ
+#  define MADV_POPULATE_READ    22
+# endif
+# ifndef MADV_POPULATE_WRITE
+#  define MADV_POPULATE_WRITE   23
+# endif
+
+# define DEFAULT_HUGETLBFS      "/dev/hugepages"
+# define SHM_DIRECTORY          "/dev/shm"
+
+/* broker requests. */
+# define BROKER_OPEN            1
+# define BROKER_UNLINK          2
+# define BROKER_UNLINK_PREFIX   3
+
+# define BROKER_MAX_NAME        255
+
+typedef struct brokerRequest
+{
+    int32_t op;
+
+    /* for BROKER_OPEN, the SHMEM_* flags the segment was opened with. */
+    int32_t flags;
+    char name[ BROKER_MAX_NAME + 1 ];
+} brokerRequest;
+
+/* sent with the segment's fd, if it was opened. */
+typedef struct brokerReply
+{
+    /* an errno value, or zero. */
+    int32_t error;
+} brokerReply;
+
+/* a segment the broker is keeping alive. */
+typedef struct brokerSegment
+{
+    char* name;
+    int fd;
+} brokerSegment;
 #endif
 
 #if _MSC_VER
 #error "TODO"
 #else
+static char* hugePath( const char* name )
+{
+    const char* mount = getenv( "DISRUPTOR_HUGETLBFS" );
+    if ( !mount || !*mount )
+        mount = DEFAULT_HUGETLBFS;
+    return strformat( "%s/%s", mount, name );
+}
+
+static const char* getBrokerName()
+{
+    const char* name = getenv( SHMEM_BROKER_ENV );
+    return ( name && *name ? name : NULL );
+}
+
+static int connectToBroker( const char* brokerName )
+{
+    struct sockaddr_un addr;
+    socklen_t len;
+    int fd;
+
+    /* an abstract socket, so there's nothing in the filesystem to clean up,
+     * and each network namespace has its own. */
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sun_family = AF_UNIX;
+    snprintf( addr.sun_path + 1, sizeof( addr.sun_path ) - 1, "%s", brokerName );
+    len = (socklen_t)( offsetof( struct sockaddr_un, sun_path ) + 1 + strlen( addr.sun_path + 1 ) );
+
+    fd = socket( AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0 );
+    if ( fd < 0 )
+        return -1;
+
+    if ( connect( fd, (struct sockaddr*)&addr, len ) < 0 )
+    {
+        int error = errno;
+        close( fd );
+        errno = error;
+        return -1;
+    }
+    return fd;
+}
+
+/* sends a request and waits for the reply, returning an errno value.  if
+ * the reply carries a descriptor, it's stored in 'fd'. */
+static int callBroker( int sock, int op, int flags, const char* name, int* fd )
+{
+    brokerRequest request;
+    brokerReply reply;
+    struct iovec iov;
+    struct msghdr msg;
+    union
+    {
+        struct cmsghdr align;
+        char buf[ CMSG_SPACE( sizeof(int) ) ];
+    } control;
+    struct cmsghdr* cmsg;
+    ssize_t ret;
+
+    if ( strlen( name ) > BROKER_MAX_NAME )
+        return ENAMETOOLONG;
+
+    memset( &request, 0, sizeof( request ) );
+    request.op = op;
+    request.flags = flags;
+    strcpy( request.name, name );
+
+    if ( send( sock, &request, sizeof( request ), MSG_NOSIGNAL ) != (ssize_t)sizeof( request ) )
+        return errno;
+
+    memset( &reply, 0, sizeof( reply ) );
+    iov.iov_base = &reply;
+    iov.iov_len = sizeof( reply );
+    memset( &msg, 0, sizeof( msg ) );
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof( control.buf );
+
+    ret = recvmsg( sock, &msg, MSG_CMSG_CLOEXEC );
+    if ( ret < 0 )
+        return errno;
+    if ( ret != (ssize_t)sizeof( reply ) )
+        return ECONNRESET;
+
+    for ( cmsg = CMSG_FIRSTHDR( &msg ); cmsg; cmsg = CMSG_NXTHDR( &msg, cmsg ) )
+    {
+        if ( cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && fd )
+            memcpy( fd, CMSG_DATA( cmsg ), sizeof(int) );
+    }
+
+    return reply.error;
+}
+
+/* makes a one-off request which doesn't return a segment. */
+static void requestFromBroker( const char* brokerName, int op, const char* name )
+{
+    int error;
+    int sock;
+
+    sock = connectToBroker( brokerName );
+    if ( sock < 0 )
+    {
+        handleError( NULL, "could not connect to broker '%s': %s", brokerName, strerror(errno) );
+        return;
+    }
+
+    error = callBroker( sock, op, 0, name, NULL );
+    if ( error && error != ENOENT )
+        handleError( NULL, "broker '%s' error: %s", brokerName, strerror(error) );
+    close( sock );
+}
+
+static void unlinkMatching( const char* directory, const char* prefix )
+{
+    size_t len = strlen( prefix );
+    struct dirent* entry;
+    DIR* dir;
+
+    dir = opendir( directory );
+    if ( !dir )
+        return;
+
+    while ( ( entry = readdir( dir ) ) != NULL )
+    {
+        if ( strncmp( entry->d_name, prefix, len ) == 0 )
+            unlinkat( dirfd( dir ), entry->d_name, 0 );
+    }
+    closedir( dir );
+}
+
 static void platformUnlink( const char* name )
 {
-    char* fullname = strformat( "/%s", name );
+    const char* brokerName = getBrokerName();
+    char* fullname;
+
+    if ( brokerName )
+    {
+        requestFromBroker( brokerName, BROKER_UNLINK, name );
+        return;
+    }
+
+    fullname = strformat( "/%s", name );
     shm_unlink( fullname );
     strfree( fullname );
+
+    /* we don't know which kind of segment it was. */
+    fullname = hugePath( name );
+    unlink( fullname );
+    strfree( fullname );
+}
+
+static void platformUnlinkPrefix( const char* prefix )
+{
+    const char* brokerName = getBrokerName();
+    const char* mount;
+
+    if ( brokerName )
+    {
+        requestFromBroker( brokerName, BROKER_UNLINK_PREFIX, prefix );
+        return;
+    }
+
+    /* shm_open() names are files in /dev/shm. */
+    unlinkMatching( SHM_DIRECTORY, prefix );
+
+    mount = getenv( "DISRUPTOR_HUGETLBFS" );
+    unlinkMatching( ( mount && *mount ? mount : DEFAULT_HUGETLBFS ), prefix );
+}
+
+static bool openFromBroker( shmem* s, const char* brokerName )
+{
+    int error;
+
+    s->broker = connectToBroker( brokerName );
+    if ( s->broker < 0 )
+    {
+        handleError( s, "could not connect to broker '%s': %s", brokerName, strerror(errno) );
+        return false;
+    }
+
+    error = callBroker( s->broker, BROKER_OPEN, s->flags, s->name, &s->fd );
+    if ( error )
+    {
+        if ( !( s->flags & SHMEM_QUIET ) )
+            handleError( s, "broker '%s' error: %s", brokerName, strerror(error) );
+        return false;
+    }
+
+    if ( s->fd < 0 )
+    {
+        handleError( s, "broker '%s' sent no segment", brokerName );
+        return false;
+    }
+    return true;
 }
 
 static bool platformStartup( shmem* s )
 {
     bool mustCreate = (s->flags & SHMEM_MUST_CREATE);
     bool mustNotCreate = (s->flags & SHMEM_MUST_NOT_CREATE);
+    bool readOnly = (s->flags & SHMEM_READ_ONLY);
+    bool hugePages = (s->flags & SHMEM_HUGE_PAGES);
+    const char* brokerName = getBrokerName();
+    int64_t pageSize = sysconf( _SC_PAGESIZE );
     int shmFlags;
     int shmMode;
     int protFlags;
+    bool resize = true;
 
     /* build the flags. */
     {
         shmFlags = 0;
-        if ( mustCreate )
+        if ( readOnly )
+        {
+            shmFlags = ( O_RDONLY );
+        }
+        else if ( mustCreate )
         {
             shmFlags = ( O_RDWR | O_CREAT | O_EXCL );
         }
@@ -229,10 +524,31 @@ static bool platformStartup( shmem* s )
 
     /* build the protection flags. */
     {
-        protFlags = ( PROT_READ | PROT_WRITE );
+        protFlags = ( readOnly ? PROT_READ : ( PROT_READ | PROT_WRITE ) );
     }
 
-    /* open the shared memory segment. */
+    /* open the shared memory segment.  huge pages come from a file on a
+     * hugetlbfs mount, which mmap() backs with them implicitly. */
+    if ( brokerName )
+    {
+        if ( !openFromBroker( s, brokerName ) )
+            return false;
+    }
+    else if ( hugePages )
+    {
+        char* fullname = hugePath( s->name );
+        s->fd = open( fullname, shmFlags | O_CLOEXEC, shmMode );
+
+        if ( s->fd < 0 )
+        {
+            if ( !( s->flags & SHMEM_QUIET ) )
+                handleError( s, "open('%s') error: %s", fullname, strerror(errno) );
+            strfree( fullname );
+            return false;
+        }
+        strfree( fullname );
+    }
+    else
     {
         char* fullname = strformat( "/%s", s->name );
         s->fd = shm_open( fullname, shmFlags, shmMode );
@@ -240,7 +556,8 @@ static bool platformStartup( shmem* s )
 
         if ( s->fd < 0 )
         {
-            handleError( s, "shm_open() error: %s", strerror(errno) );
+            if ( !( s->flags & SHMEM_QUIET ) )
+                handleError( s, "shm_open() error: %s", strerror(errno) );
             return false;
         }
     }
@@ -257,13 +574,42 @@ static bool platformStartup( shmem* s )
             return false;
         }
 
-        if ( info.st_blksize > s->size )
+        /* a reader takes the segment as it is, and can't grow it. */
+        if ( readOnly )
+        {
+            if ( info.st_size < s->size || info.st_size == 0 )
+            {
+                handleError( s, "segment is %lld bytes; expected at least %lld",
+                        (long long)info.st_size, (long long)s->size );
+                return false;
+            }
+            s->size = info.st_size;
+            resize = false;
+        }
+
+        if ( !readOnly && info.st_blksize > s->size )
         {
             s->size = info.st_blksize;
         }
+
+        /* on hugetlbfs, the block size is the huge page size, and the
+         * segment must be a whole number of them. */
+        if ( hugePages )
+        {
+            pageSize = info.st_blksize;
+            s->size = ( ( s->size + pageSize - 1 ) / pageSize ) * pageSize;
+        }
+
+        /* never shrink a segment someone else created. */
+        if ( info.st_size >= s->size )
+        {
+            s->size = info.st_size;
+            resize = false;
+        }
     }
 
     /* resize the shared memory. */
+    if ( resize )
     {
         int ret;
 
@@ -281,6 +627,30 @@ static bool platformStartup( shmem* s )
         if ( s->mapped == MAP_FAILED )
         {
             handleError( s, "mmap() error: %s", strerror(errno) );
+            s->mapped = NULL;
+            return false;
+        }
+    }
+
+    /* place the pages before anything faults them in; pages which already
+     * exist are moved. */
+    if ( s->flags & SHMEM_NODE_MASK )
+    {
+        if ( !platformBind( s, SHMEM_GET_NODE( s->flags ) ) )
+            return false;
+    }
+
+    if ( s->flags & SHMEM_PREFAULT )
+    {
+        if ( !platformPrefault( s, pageSize ) )
+            return false;
+    }
+
+    if ( s->flags & SHMEM_LOCK )
+    {
+        if ( mlock( s->mapped, s->size ) < 0 )
+        {
+            handleError( s, "mlock() error: %s", strerror(errno) );
             return false;
         }
     }
@@ -288,6 +658,51 @@ static bool platformStartup( shmem* s )
     return true;
 }
 
+static bool platformBind( shmem* s, int node )
+{
+    unsigned long mask[ ( SHMEM_GET_NODE( SHMEM_NODE_MASK ) + 1 ) / ( 8 * sizeof(unsigned long) ) + 1 ];
+    unsigned long bits = ( 8 * sizeof(unsigned long) );
+    long ret;
+
+    memset( mask, 0, sizeof( mask ) );
+    mask[ node / bits ] |= ( 1UL << ( node % bits ) );
+
+    /* the kernel reads one bit fewer than it's told. */
+    ret = syscall( SYS_mbind, s->mapped, (unsigned long)s->size, MPOL_BIND, mask,
+            (unsigned long)( sizeof( mask ) * 8 + 1 ), MPOL_MF_MOVE );
+    if ( ret < 0 )
+    {
+        handleError( s, "mbind() to node %d error: %s", node, strerror(errno) );
+        return false;
+    }
+    return true;
+}
+
+static bool platformPrefault( shmem* s, int64_t pageSize )
+{
+    bool readOnly = (s->flags & SHMEM_READ_ONLY);
+    volatile char* p;
+    int64_t i;
+
+    /* populating the page tables in one call avoids a fault per page, and
+     * unlike touching the pages, never writes to them. */
+    if ( madvise( s->mapped, s->size, readOnly ? MADV_POPULATE_READ : MADV_POPULATE_WRITE ) == 0 )
+        return true;
+
+    if ( errno != EINVAL )
+    {
+        handleError( s, "madvise() error: %s", strerror(errno) );
+        return false;
+    }
+
+    /* older kernels; a read is enough to allocate each page, and can't
+     * disturb anyone else's writes. */
+    p = s->mapped;
+    for ( i = 0; i < s->size; i += pageSize )
+        (void)p[ i ];
+    return true;
+}
+
 static void platformShutdown( shmem* s )
 {
     /* unmap the memory. */
@@ -303,6 +718,270 @@ static void platformShutdown( shmem* s )
         close( s->fd );
         s->fd = -1;
     }
+
+    if ( s->broker >= 0 )
+    {
+        close( s->broker );
+        s->broker = -1;
+    }
+}
+
+static void* growArray( void* array, int count, int* capacity, size_t size )
+{
+    void* result;
+
+    if ( count < *capacity )
+        return array;
+
+    *capacity = ( *capacity ? *capacity * 2 : 16 );
+    result = zmalloc( *capacity * size );
+    if ( array )
+        memcpy( result, array, count * size );
+    zfree( array );
+    return result;
 }
-#endif /* !_MSC_VER */
 
+static void sendReply( int sock, int error, int fd )
+{
+    brokerReply reply;
+    struct iovec iov;
+    struct msghdr msg;
+    union
+    {
+        struct cmsghdr align;
+        char buf[ CMSG_SPACE( sizeof(int) ) ];
+    } control;
+
+    memset( &reply, 0, sizeof( reply ) );
+    reply.error = error;
+    iov.iov_base = &reply;
+    iov.iov_len = sizeof( reply );
+    memset( &msg, 0, sizeof( msg ) );
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if ( fd >= 0 )
+    {
+        struct cmsghdr* cmsg;
+
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof( control.buf );
+        cmsg = CMSG_FIRSTHDR( &msg );
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN( sizeof(int) );
+        memcpy( CMSG_DATA( cmsg ), &fd, sizeof(int) );
+    }
+
+    /* if they've gone away, we'll notice when we next poll. */
+    sendmsg( sock, &msg, MSG_NOSIGNAL );
+}
+
+static int findSegment( brokerSegment* segments, int count, const char* name )
+{
+    int i;
+    for ( i = 0; i < count; ++i )
+    {
+        if ( strcmp( segments[ i ].name, name ) == 0 )
+            return i;
+    }
+    return -1;
+}
+
+static void dropSegment( brokerSegment* segments, int* count, int at )
+{
+    handleDebug( NULL, "broker dropping '%s'", segments[ at ].name );
+    close( segments[ at ].fd );
+    strfree( segments[ at ].name );
+    segments[ at ] = segments[ *count - 1 ];
+    *count -= 1;
+}
+
+static int createSegment( const brokerRequest* request )
+{
+    unsigned int memfdFlags = ( MFD_CLOEXEC | MFD_ALLOW_SEALING );
+    int fd;
+
+    if ( request->flags & SHMEM_HUGE_PAGES )
+        memfdFlags |= MFD_HUGETLB;
+
+    fd = memfd_create( request->name, memfdFlags );
+    if ( fd < 0 )
+        return -1;
+
+    /* whoever opens it may grow it, but mustn't shrink it out from under
+     * anyone else's mapping. */
+    if ( fcntl( fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL ) < 0 )
+    {
+        int error = errno;
+        close( fd );
+        errno = error;
+        return -1;
+    }
+    return fd;
+}
+
+static bool platformRunBroker( const char* brokerName )
+{
+    struct sockaddr_un addr;
+    socklen_t len;
+    struct pollfd* fds = NULL;
+    int fdsCount = 0;
+    int fdsCapacity = 0;
+    brokerSegment* segments = NULL;
+    int segmentsCount = 0;
+    int segmentsCapacity = 0;
+    int listener;
+
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sun_family = AF_UNIX;
+    snprintf( addr.sun_path + 1, sizeof( addr.sun_path ) - 1, "%s", brokerName );
+    len = (socklen_t)( offsetof( struct sockaddr_un, sun_path ) + 1 + strlen( addr.sun_path + 1 ) );
+
+    listener = socket( AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0 );
+    if ( listener < 0 || bind( listener, (struct sockaddr*)&addr, len ) < 0 || listen( listener, 128 ) < 0 )
+    {
+        handleError( NULL, "broker '%s' could not listen: %s", brokerName, strerror(errno) );
+        if ( listener >= 0 )
+            close( listener );
+        return false;
+    }
+
+    fds = growArray( fds, fdsCount, &fdsCapacity, sizeof( struct pollfd ) );
+    fds[ 0 ].fd = listener;
+    fds[ 0 ].events = POLLIN;
+    fdsCount = 1;
+    handleInfo( NULL, "broker '%s' listening", brokerName );
+
+    for ( ;; )
+    {
+        int i;
+
+        if ( poll( fds, fdsCount, -1 ) < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            handleError( NULL, "broker '%s' poll() error: %s", brokerName, strerror(errno) );
+            break;
+        }
+
+        /* serve the clients, removing any who have gone away. */
+        for ( i = fdsCount - 1; i >= 1; --i )
+        {
+            brokerRequest request;
+            ssize_t ret;
+            int at;
+
+            if ( !fds[ i ].revents )
+                continue;
+
+            ret = recv( fds[ i ].fd, &request, sizeof( request ), 0 );
+            if ( ret <= 0 || ret != (ssize_t)sizeof( request ) )
+            {
+                close( fds[ i ].fd );
+                fds[ i ] = fds[ fdsCount - 1 ];
+                fdsCount -= 1;
+                continue;
+            }
+
+            request.name[ BROKER_MAX_NAME ] = '\0';
+            at = findSegment( segments, segmentsCount, request.name );
+
+            if ( request.op == BROKER_OPEN )
+            {
+                bool mayCreate = !( request.flags & ( SHMEM_MUST_NOT_CREATE | SHMEM_READ_ONLY ) );
+
+                if ( at >= 0 && ( request.flags & SHMEM_MUST_CREATE ) )
+                    sendReply( fds[ i ].fd, EEXIST, -1 );
+                else if ( at < 0 && !mayCreate )
+                    sendReply( fds[ i ].fd, ENOENT, -1 );
+                else
+                {
+                    if ( at < 0 )
+                    {
+                        int fd = createSegment( &request );
+                        if ( fd < 0 )
+                        {
+                            int error = errno;
+                            handleError( NULL, "broker could not create '%s': %s", request.name, strerror(error) );
+                            sendReply( fds[ i ].fd, error, -1 );
+                            continue;
+                        }
+
+                        segments = growArray( segments, segmentsCount, &segmentsCapacity, sizeof( brokerSegment ) );
+                        at = segmentsCount++;
+                        segments[ at ].name = strclone( request.name );
+                        segments[ at ].fd = fd;
+                        handleDebug( NULL, "broker created '%s'", request.name );
+                    }
+                    sendReply( fds[ i ].fd, 0, segments[ at ].fd );
+                }
+            }
+            else if ( request.op == BROKER_UNLINK )
+            {
+                if ( at >= 0 )
+                    dropSegment( segments, &segmentsCount, at );
+                sendReply( fds[ i ].fd, ( at >= 0 ? 0 : ENOENT ), -1 );
+            }
+            else if ( request.op == BROKER_UNLINK_PREFIX )
+            {
+                size_t prefixLength = strlen( request.name );
+                for ( at = segmentsCount - 1; at >= 0; --at )
+                {
+                    if ( strncmp( segments[ at ].name, request.name, prefixLength ) == 0 )
+                        dropSegment( segments, &segmentsCount, at );
+                }
+                sendReply( fds[ i ].fd, 0, -1 );
+            }
+            else
+            {
+                sendReply( fds[ i ].fd, EINVAL, -1 );
+            }
+        }
+
+        /* once nobody has anything open, nobody can be using any of it. */
+        if ( fdsCount == 1 )
+        {
+            while ( segmentsCount > 0 )
+                dropSegment( segments, &segmentsCount, segmentsCount - 1 );
+        }
+
+        /* only accept after serving, so that new clients' slots in 'fds'
+         * haven't been polled yet. */
+        if ( fds[ 0 ].revents & POLLIN )
+        {
+            struct ucred cred;
+            socklen_t credLength = sizeof( cred );
+            int client;
+
+            client = accept4( listener, NULL, NULL, SOCK_CLOEXEC );
+            if ( client < 0 )
+                continue;
+
+            /* segments in /dev/shm are only open to their owner; so are
+             * the broker's. */
+            if ( getsockopt( client, SOL_SOCKET, SO_PEERCRED, &cred, &credLength ) < 0
+                    || cred.uid != geteuid() )
+            {
+                handleWarning( NULL, "broker refusing a client of another user" );
+                close( client );
+                continue;
+            }
+
+            fds = growArray( fds, fdsCount, &fdsCapacity, sizeof( struct pollfd ) );
+            fds[ fdsCount ].fd = client;
+            fds[ fdsCount ].events = POLLIN;
+            fds[ fdsCount ].revents = 0;
+            fdsCount += 1;
+        }
+    }
+
+    while ( segmentsCount > 0 )
+        dropSegment( segments, &segmentsCount, segmentsCount - 1 );
+    zfree( segments );
+    for ( ; fdsCount > 0; --fdsCount )
+        close( fds[ fdsCount - 1 ].fd );
+    zfree( fds );
+    return false;
+}
+#endif /* !_MSC_VER */
@@ -2,6 +2,7 @@
 #define __DISRUPTOR_SHMEM_H__
 
 #include <stdint.h> 
+#include "util.h"
 /*-----------------------------------------------------------------------------
 * Declarations
 *----------------------------------------------------------------------------*/
@@ -12,17 +13,46 @@ typedef struct shmem shmem;
 /* flags. */
 #define SHMEM_MUST_CREATE       (1 << 0)
 #define SHMEM_MUST_NOT_CREATE   (1 << 1)
+#define SHMEM_QUIET             (1 << 2)
+#define SHMEM_READ_ONLY         (1 << 3)
 #define SHMEM_DEFAULT           0
 
+/* back the segment with huge pages, from a hugetlbfs mount rather than
+ * /dev/shm.  everyone who opens it must say so.  the mount is
+ * /dev/hugepages unless $DISRUPTOR_HUGETLBFS names another. */
+#define SHMEM_HUGE_PAGES        (1 << 4)
+
+/* fault every page in when it's mapped, rather than on first touch. */
+#define SHMEM_PREFAULT          (1 << 5)
+
+/* keep the mapping resident; implies SHMEM_PREFAULT. */
+#define SHMEM_LOCK              (1 << 6)
+
+/* place the segment's pages on the given NUMA node. */
+#define SHMEM_NODE( node )      ( ( (node) + 1 ) << 16 )
+#define SHMEM_NODE_MASK         ( 0x7fff << 16 )
+#define SHMEM_GET_NODE( flags ) ( ( ( (flags) & SHMEM_NODE_MASK ) >> 16 ) - 1 )
+
+/* if $DISRUPTOR_BROKER names a broker, every segment is an anonymous
+ * memfd which the broker hands out over a unix socket, rather than a name
+ * in /dev/shm.  the broker forgets them all once no process has any open,
+ * so nothing is left behind by a crash. */
+#define SHMEM_BROKER_ENV        "DISRUPTOR_BROKER"
+
 /*-----------------------------------------------------------------------------
 * Function prototypes
 *----------------------------------------------------------------------------*/
 
 void shmemUnlink( const char* formatName, ... );
+void shmemUnlinkPrefix( const char* formatPrefix, ... );
 shmem* shmemOpen( int64_t size, int flags, const char* formatName, ... );
 void shmemClose( shmem* s );
 int64_t shmemGetSize( shmem* s );
 void* shmemGetPtr( shmem* s );
 
+/* serve segments as the broker named 'brokerName'.  only returns if the
+ * broker couldn't be started. */
+bool shmemRunBroker( const char* brokerName );
+
 #endif
 
@@ -1,9 +1,12 @@
+#define _POSIX_C_SOURCE 200809L
 #include "util.h"
 
 #include <string.h>
 #include <assert.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <errno.h>
+#include <signal.h>
 #include "zmalloc.h"
 
 void strfree( char* str )
@@ -59,4 +62,9 @@ char* strformat( const char* fmt, ... )
     return result;
 }
 
+bool isProcessAlive( int64_t pid )
+{
+    return ( kill( (pid_t)pid, 0 ) == 0 || errno != ESRCH );
+}
+
 
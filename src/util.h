@@ -23,4 +23,8 @@ char* strclone( const char* str );
 char* strformat( const char* fmt, ... );
 char* vstrformat( const char* fmt, va_list ap );
 
+/* process utilities.  whether 'pid' is still running; every process which
+ * asks about another must share its pid namespace. */
+bool isProcessAlive( int64_t pid );
+
 #endif
@@ -0,0 +1,209 @@
+#define _GNU_SOURCE
+#include "waiter.h"
+
+#include "atomics.h"
+#include <time.h>
+
+/* how long to spin before falling back to something gentler. */
+#define SPIN_ATTEMPTS           64
+#define YIELD_ATTEMPTS          64
+
+/* the backoff sleep doubles up to this many nanoseconds. */
+#define MAX_BACKOFF_NS          ( 1000 * 1000 )
+
+/* a blocked thread rechecks at least this often, in case a wakeup raced
+ * with a participant joining the ring. */
+#define MAX_BLOCK_NS            ( 10 * 1000 * 1000 )
+
+/* forward declarations. */
+static int64_t now();
+static bool isExpired( waiter* w );
+static void platformSleep( int64_t ns );
+static void platformWait( int32_t* signal, int32_t seen, int64_t ns );
+static void platformWake( int32_t* signal );
+
+/*-----------------------------------------------------------------------------
+* Public API definitions.
+*----------------------------------------------------------------------------*/
+
+bool waiterIsValid( int strategy )
+{
+    switch ( strategy )
+    {
+    case WAITER_YIELD:
+    case WAITER_SPIN:
+    case WAITER_BACKOFF:
+    case WAITER_BLOCK:
+        return true;
+    }
+    return false;
+}
+
+void waiterInit( waiter* w, int strategy, int64_t timeoutMs,
+        int32_t* signal, int64_t* waiters )
+{
+    w->strategy = strategy;
+    w->attempts = 0;
+    w->deadline = ( timeoutMs < 0 ? -1 : now() + timeoutMs * 1000 * 1000 );
+    w->signal = signal;
+    w->waiters = waiters;
+    w->registered = false;
+}
+
+int32_t waiterBegin( waiter* w )
+{
+    /* announce ourselves before sampling the signal, so that anyone who
+     * changes the condition after this point knows to wake us. */
+    if ( w->strategy == WAITER_BLOCK && w->attempts >= SPIN_ATTEMPTS && !w->registered )
+    {
+        xadd64( w->waiters, 1 );
+        w->registered = true;
+        atomicBarrier();
+    }
+    return atomicLoadRelaxed32( w->signal );
+}
+
+bool waiterIdle( waiter* w, int32_t seen )
+{
+    int64_t attempts = w->attempts++;
+
+    switch ( w->strategy )
+    {
+    case WAITER_SPIN:
+        atomicPause();
+
+        /* don't read the clock on every iteration. */
+        if ( w->deadline >= 0 && ( attempts & 1023 ) == 0 )
+            return !isExpired( w );
+        return true;
+
+    case WAITER_BACKOFF:
+        if ( attempts < SPIN_ATTEMPTS )
+            atomicPause();
+        else if ( attempts < SPIN_ATTEMPTS + YIELD_ATTEMPTS )
+            atomicYield();
+        else
+        {
+            int64_t shift = ( attempts - SPIN_ATTEMPTS - YIELD_ATTEMPTS );
+            int64_t ns = MAX_BACKOFF_NS;
+            if ( shift < 20 )
+                ns = ( (int64_t)1000 << shift );
+            if ( ns > MAX_BACKOFF_NS )
+                ns = MAX_BACKOFF_NS;
+            platformSleep( ns );
+        }
+        break;
+
+    case WAITER_BLOCK:
+        if ( !w->registered )
+            atomicPause();
+        else
+        {
+            int64_t ns = MAX_BLOCK_NS;
+            if ( w->deadline >= 0 )
+            {
+                int64_t remaining = ( w->deadline - now() );
+                if ( remaining <= 0 )
+                    return false;
+                if ( remaining < ns )
+                    ns = remaining;
+            }
+            platformWait( w->signal, seen, ns );
+        }
+        break;
+
+    default:
+        atomicYield();
+        break;
+    }
+
+    return !isExpired( w );
+}
+
+void waiterEnd( waiter* w )
+{
+    if ( w->registered )
+    {
+        xadd64( w->waiters, -1 );
+        w->registered = false;
+    }
+}
+
+void waiterWakeAll( int32_t* signal, int64_t* waiters )
+{
+    if ( !atomicLoadRelaxed64( waiters ) )
+        return;
+
+    xadd32( signal, 1 );
+    platformWake( signal );
+}
+
+/*-----------------------------------------------------------------------------
+* File-local function definitions.
+*----------------------------------------------------------------------------*/
+
+static int64_t now()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ( (int64_t)ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec );
+}
+
+static bool isExpired( waiter* w )
+{
+    if ( w->deadline < 0 )
+        return false;
+    return ( now() >= w->deadline );
+}
+
+/*-----------------------------------------------------------------------------
+* Platform-specific function definitions.
+*----------------------------------------------------------------------------*/
+
+#if _MSC_VER
+#error "TODO"
+#else
+# include <unistd.h>
+# if __linux__
+#  include <linux/futex.h>
+#  include <sys/syscall.h>
+# endif
+
+static void platformSleep( int64_t ns )
+{
+    struct timespec ts;
+    ts.tv_sec = ( ns / ( 1000 * 1000 * 1000 ) );
+    ts.tv_nsec = ( ns % ( 1000 * 1000 * 1000 ) );
+    nanosleep( &ts, NULL );
+}
+
+#if __linux__
+static void platformWait( int32_t* signal, int32_t seen, int64_t ns )
+{
+    struct timespec ts;
+    ts.tv_sec = ( ns / ( 1000 * 1000 * 1000 ) );
+    ts.tv_nsec = ( ns % ( 1000 * 1000 * 1000 ) );
+
+    /* the segment is mapped into several processes, so this can't be a
+     * private futex. */
+    syscall( SYS_futex, signal, FUTEX_WAIT, seen, &ts, NULL, 0 );
+}
+
+static void platformWake( int32_t* signal )
+{
+    syscall( SYS_futex, signal, FUTEX_WAKE, 0x7fffffff, NULL, NULL, 0 );
+}
+#else
+static void platformWait( int32_t* signal, int32_t seen, int64_t ns )
+{
+    /* no futexes; poll gently instead. */
+    if ( atomicLoadRelaxed32( signal ) == seen )
+        platformSleep( ns < MAX_BACKOFF_NS ? ns : MAX_BACKOFF_NS );
+}
+
+static void platformWake( int32_t* signal )
+{
+    (void)signal;
+}
+#endif /* !__linux__ */
+#endif /* !_MSC_VER */
@@ -0,0 +1,54 @@
+#ifndef __DISRUPTOR_WAITER_H__
+#define __DISRUPTOR_WAITER_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "util.h"
+
+/*-----------------------------------------------------------------------------
+* Declarations
+*----------------------------------------------------------------------------*/
+
+/* strategies. */
+#define WAITER_YIELD            0
+#define WAITER_SPIN             1
+#define WAITER_BACKOFF          2
+#define WAITER_BLOCK            3
+
+/* state for a single wait; lives on the waiting thread's stack. */
+typedef struct waiter
+{
+    int strategy;
+    int64_t attempts;
+    int64_t deadline;
+
+    /* shared futex word, and the count of threads sleeping on it. */
+    int32_t* signal;
+    int64_t* waiters;
+    bool registered;
+} waiter;
+
+/*-----------------------------------------------------------------------------
+* Function prototypes
+*----------------------------------------------------------------------------*/
+
+bool waiterIsValid( int strategy );
+void waiterInit( waiter* w, int strategy, int64_t timeoutMs,
+        int32_t* signal, int64_t* waiters );
+
+/* call before checking the condition being waited on; returns the signal
+ * value to pass to waiterIdle(). */
+int32_t waiterBegin( waiter* w );
+
+/* wait a little while for the condition to change.  returns false once the
+ * timeout has elapsed. */
+bool waiterIdle( waiter* w, int32_t seen );
+
+/* call once the wait is over, whether or not it succeeded. */
+void waiterEnd( waiter* w );
+
+/* wake every thread sleeping on 'signal'. */
+void waiterWakeAll( int32_t* signal, int64_t* waiters );
+
+#endif
+
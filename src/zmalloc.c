@@ -1,19 +1,282 @@
 #include "zmalloc.h"
 
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "atomics.h"
+
+/* jemalloc and tcmalloc already have size classes of their own. */
+#if defined(USE_JEMALLOC) || defined(USE_TCMALLOC)
+# define ZMALLOC_USE_SLAB   0
+#else
+# define ZMALLOC_USE_SLAB   1
+#endif
+
+/* every allocation is preceded by its size, padded so that what follows
+ * is as aligned as malloc's own result. */
+#define PREFIX_SIZE         16
+#define ALIGN( n )          ( ( (n) + PREFIX_SIZE - 1 ) & ~(size_t)( PREFIX_SIZE - 1 ) )
+
+/* slab blocks of 16, 32, 64, 128 and 256 bytes, which covers the names
+ * built for every segment we open. */
+#define SLAB_MIN_SHIFT      4
+#define SLAB_CLASSES        5
+#define SLAB_MAX_SIZE       ( (size_t)1 << ( SLAB_MIN_SHIFT + SLAB_CLASSES - 1 ) )
+
+/* slabs are carved out of chunks of this size, which are never given
+ * back; free blocks just wait to be reused. */
+#define SLAB_CHUNK_SIZE     ( 64 * 1024 )
+
+/* arena chunks hold at least this much, and anything bigger than a
+ * quarter of it gets a chunk to itself. */
+#define ARENA_CHUNK_SIZE    ( 16 * 1024 )
+#define ARENA_HEADER_SIZE   ALIGN( sizeof(arenaChunk) )
+
+/*-----------------------------------------------------------------------------
+* Declarations
+*----------------------------------------------------------------------------*/
+
+typedef struct slabBlock slabBlock;
+struct slabBlock
+{
+    slabBlock* next;
+};
+
+typedef struct arenaChunk arenaChunk;
+struct arenaChunk
+{
+    arenaChunk* next;
+    size_t used;
+    size_t size;
+};
+
+struct zarena
+{
+    /* the first chunk is the one currently being filled. */
+    arenaChunk* chunks;
+};
+
+/* bytes handed out and not yet freed, process-wide. */
+static int64_t used;
+static int64_t peak;
+
+#if ZMALLOC_USE_SLAB
+/* each thread frees into its own lists, so a block freed by another
+ * thread than allocated it simply moves over. */
+static __thread slabBlock* freeLists[ SLAB_CLASSES ];
+#endif
+
+/*-----------------------------------------------------------------------------
+* Static function prototypes
+*----------------------------------------------------------------------------*/
+
+static void* allocate( size_t size, bool zero );
+static void account( int64_t delta );
+#if ZMALLOC_USE_SLAB
+static int getSlabClass( size_t size );
+static void* slabAlloc( int c );
+static slabBlock* slabRefill( int c );
+#endif
+
+/*-----------------------------------------------------------------------------
+* Public API definitions.
+*----------------------------------------------------------------------------*/
 
 void* zmalloc( size_t size )
 {
-    return malloc( size );
+    return allocate( size, false );
 }
 
 void* zcalloc( size_t size )
 {
-    return calloc( 1, size );
+    return allocate( size, true );
 }
 
 void zfree( void* ptr )
 {
-    free( ptr );
+    size_t* prefix;
+    size_t size;
+
+    if ( !ptr )
+        return;
+
+    prefix = (size_t*)( (char*)ptr - PREFIX_SIZE );
+    size = *prefix;
+    account( -(int64_t)size );
+
+#if ZMALLOC_USE_SLAB
+    if ( size <= SLAB_MAX_SIZE )
+    {
+        int c = getSlabClass( size );
+        slabBlock* b = (slabBlock*)prefix;
+
+        b->next = freeLists[ c ];
+        freeLists[ c ] = b;
+        return;
+    }
+#endif
+
+    free( prefix );
+}
+
+size_t zmallocUsed( void )
+{
+    return (size_t)atomicLoadRelaxed64( &used );
+}
+
+size_t zmallocPeak( void )
+{
+    return (size_t)atomicLoadRelaxed64( &peak );
+}
+
+zarena* zarenaCreate( void )
+{
+    return zcalloc( sizeof(zarena) );
+}
+
+void zarenaRelease( zarena* a )
+{
+    if ( !a )
+        return;
+
+    zarenaClear( a );
+    zfree( a );
+}
+
+void* zarenaAlloc( zarena* a, size_t size )
+{
+    arenaChunk* chunk = a->chunks;
+    char* result;
+
+    size = ALIGN( size );
+    if ( !chunk || chunk->size - chunk->used < size )
+    {
+        size_t capacity = ( size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE );
+
+        /* chunks come from zcalloc, and are never reused once cleared, so
+         * everything handed out is already zero. */
+        chunk = zcalloc( ARENA_HEADER_SIZE + capacity );
+        if ( !chunk )
+            return NULL;
+        chunk->size = capacity;
+
+        /* keep filling the current chunk if this one is only for us. */
+        if ( a->chunks && size > ARENA_CHUNK_SIZE / 4 )
+        {
+            chunk->next = a->chunks->next;
+            a->chunks->next = chunk;
+        }
+        else
+        {
+            chunk->next = a->chunks;
+            a->chunks = chunk;
+        }
+    }
+
+    result = (char*)chunk + ARENA_HEADER_SIZE + chunk->used;
+    chunk->used += size;
+    return result;
+}
+
+void zarenaClear( zarena* a )
+{
+    while ( a->chunks )
+    {
+        arenaChunk* next = a->chunks->next;
+        zfree( a->chunks );
+        a->chunks = next;
+    }
+}
+
+/*-----------------------------------------------------------------------------
+* Static function definitions.
+*----------------------------------------------------------------------------*/
+
+static void* allocate( size_t size, bool zero )
+{
+    size_t* prefix;
+
+#if ZMALLOC_USE_SLAB
+    if ( size <= SLAB_MAX_SIZE )
+    {
+        int c = getSlabClass( size );
+
+        size = ( (size_t)1 << ( SLAB_MIN_SHIFT + c ) );
+        prefix = slabAlloc( c );
+        if ( prefix && zero )
+            memset( (char*)prefix + PREFIX_SIZE, 0, size );
+    }
+    else
+#endif
+    {
+        /* calloc can skip zeroing memory which is fresh from the kernel. */
+        prefix = ( zero ? calloc( 1, PREFIX_SIZE + size ) : malloc( PREFIX_SIZE + size ) );
+    }
+
+    if ( !prefix )
+        return NULL;
+
+    *prefix = size;
+    account( (int64_t)size );
+    return (char*)prefix + PREFIX_SIZE;
+}
+
+static void account( int64_t delta )
+{
+    int64_t now = xadd64( &used, delta );
+    int64_t highest = atomicLoadRelaxed64( &peak );
+
+    while ( now > highest )
+    {
+        int64_t prev = cas64( &peak, highest, now );
+        if ( prev == highest )
+            break;
+        highest = prev;
+    }
+}
+
+#if ZMALLOC_USE_SLAB
+static int getSlabClass( size_t size )
+{
+    int c = 0;
+
+    while ( ( (size_t)1 << ( SLAB_MIN_SHIFT + c ) ) < size )
+        ++c;
+    return c;
+}
+
+static void* slabAlloc( int c )
+{
+    slabBlock* b = freeLists[ c ];
+
+    if ( !b )
+    {
+        b = slabRefill( c );
+        if ( !b )
+            return NULL;
+    }
+
+    freeLists[ c ] = b->next;
+    return b;
+}
+
+static slabBlock* slabRefill( int c )
+{
+    size_t blockSize = PREFIX_SIZE + ( (size_t)1 << ( SLAB_MIN_SHIFT + c ) );
+    size_t count = SLAB_CHUNK_SIZE / blockSize;
+    char* chunk;
+    size_t i;
+
+    chunk = malloc( SLAB_CHUNK_SIZE );
+    if ( !chunk )
+        return NULL;
+
+    for ( i = 0; i + 1 < count; ++i )
+        ( (slabBlock*)( chunk + i * blockSize ) )->next = (slabBlock*)( chunk + ( i + 1 ) * blockSize );
+    ( (slabBlock*)( chunk + i * blockSize ) )->next = NULL;
+
+    return (slabBlock*)chunk;
 }
+#endif
 
@@ -3,9 +3,35 @@
 
 #include <stddef.h>
 
+/*-----------------------------------------------------------------------------
+* Declarations
+*----------------------------------------------------------------------------*/
+
+struct zarena;
+typedef struct zarena zarena;
+
+/*-----------------------------------------------------------------------------
+* Function prototypes
+*----------------------------------------------------------------------------*/
+
+/* small allocations come from per-thread size-class slabs, and anything
+ * else from malloc; 'make MALLOC=jemalloc' or 'MALLOC=tcmalloc' hands
+ * everything to that library instead. */
 void* zmalloc( size_t size );
 void* zcalloc( size_t size );
 void zfree( void* ptr );
 
+/* the bytes currently allocated by this process, and the most there have
+ * ever been at once. */
+size_t zmallocUsed( void );
+size_t zmallocPeak( void );
+
+/* an arena hands out zero-filled memory which is only ever freed all at
+ * once, by zarenaClear() or zarenaRelease(). */
+zarena* zarenaCreate( void );
+void zarenaRelease( zarena* a );
+void* zarenaAlloc( zarena* a, size_t size );
+void zarenaClear( zarena* a );
+
 #endif
 